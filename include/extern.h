@@ -16,24 +16,134 @@ struct pingmode {
 	unsigned char *packet;
 };
 
+struct deadline;
+
 struct filemode {
 	int mtime;
+	int watched;				/* changes seen by inotify, see file_stat.c */
+	int need_stat;
+	time_t changed;				/* monotonic time of last change */
+	time_t next_stat;			/* monotonic time of next stat() */
+	struct deadline *dl;		/* helper for network file systems */
+	time_t job_mtime;			/* result from helper */
+	int rebase;					/* clock stepped, see rebase_filecheck() */
+	time_t rebase_mtime;
 };
 
 struct ifmode {
 	unsigned long bytes;
 };
 
+struct temptrend;
+
 struct tempmode {
 	int	in_use;
+	int fd;
+	int autodetected;
+	int max;					/* limit and warning levels in milli-Celsius */
+	int level1, level2, level3;
+	struct temptrend *trend;	/* recent samples for prediction, see temp.c */
+	int alarm_fd, crit_alarm_fd;	/* hwmon alarm attributes, if used */
+	int skip;					/* intervals since last sample */
 	unsigned char have1, have2, have3;
 };
 
+struct pidmode {
+	pid_t pid;
+	int pidfd;					/* -1 if not using pidfd, see pidfile.c */
+	int watched;				/* PID file is watched by inotify */
+	int changed;				/* PID file needs to be read again */
+	time_t written;				/* CLOCK_BOOTTIME seconds when seen written, 0 if not */
+	int dead;
+	int stuck;					/* limits for optional deep checks (seconds) */
+	int progress;
+	pid_t deep_pid;				/* process the following refer to */
+	int stat_fd, io_fd;
+	time_t state_since;			/* when seen entering D or T state */
+	time_t work_since;			/* when CPU or I/O count last changed */
+	unsigned long long work;
+};
+
+struct mountmode {
+	struct deadline *dl;		/* helper thread, see mountresp.c */
+	int timeouts;				/* in a row */
+	long job_us;				/* time taken by the last call */
+	long avg_us, max_us;
+};
+
+struct mntwatch {
+	int found;					/* in the mount table, see mountwatch.c */
+	int readonly;
+};
+
+struct cgroupmode {
+	int events_fd;				/* cgroup files, see cgroup.c */
+	int memev_fd;
+	int psi_fd;
+	int populated;
+	long long oom_kill;			/* counts from memory.events */
+	long long high;
+	int streak;					/* pressure windows in a row */
+	long long last_psi;			/* monotonic ms of last pressure event */
+};
+
+struct mdmode {
+	int state_fd;				/* md attributes, see mdraid.c */
+	int degraded_fd;
+	int action_fd;
+};
+
+struct kmsgmode {
+	int code;					/* error reported, see kmsg.c */
+	int count;					/* matches within 'period' seconds to report it */
+	int period;
+	unsigned long long *times;	/* ring of the last 'count' match times */
+	int next;
+	unsigned long long last_seq;
+};
+
+struct fsmode {
+	int fd;						/* kept open for fstatfs() */
+	int min_free;				/* percentages, -1 if not given */
+	int min_inodes;
+};
+
+struct diskprobe;
+
+struct diskmode {
+	struct diskprobe *probe;	/* see diskprobe.c */
+};
+
+struct procmode {
+	int count;					/* number of processes running, see procmon.c */
+};
+
 union wdog_options {
 	struct pingmode net;
 	struct filemode file;
 	struct ifmode iface;
 	struct tempmode temp;
+	struct pidmode pid;
+	struct procmode proc;
+	struct mountmode mount;
+	struct diskmode disk;
+	struct fsmode fs;
+	struct mntwatch mwatch;
+	struct kmsgmode kmsg;
+	struct mdmode md;
+	struct cgroupmode cgroup;
+};
+
+struct snapshot {
+	int valid;
+	unsigned long load[3];		/* 1, 5 & 15 minute load averages, scaled by LOAD_SCALE */
+	unsigned long freemem;		/* free memory in kB */
+	unsigned long freeswap;		/* free swap in kB */
+	unsigned long procs;		/* number of tasks */
+	unsigned long procs_running;	/* runnable tasks, from /proc/stat */
+	unsigned long procs_blocked;	/* tasks blocked on I/O, from /proc/stat */
+	int ncpus;					/* number of on-line CPUs */
+	const char *stat_text;		/* contents of /proc/stat (if read) */
 };
 
 struct list {
@@ -65,6 +175,10 @@ struct list {
 
 #define TS_SIZE	12
 
+#define LOAD_SCALE	100	/* fixed-point scaling for load averages, as /proc/loadavg resolution */
+#define LOAD_INT(x)		((x) / LOAD_SCALE)
+#define LOAD_FRAC(x)	((x) % LOAD_SCALE)
+
 /* === External variables === */
 /* From configfile.c */
 extern int tint;
@@ -74,11 +188,39 @@ extern int schedprio;
 extern int maxload1;
 extern int maxload5;
 extern int maxload15;
+extern int maxload1_cpu;
+extern int maxload5_cpu;
+extern int maxload15_cpu;
+extern int maxrunning;
+extern int maxblocked;
+extern int maxsteal;
+extern int maxiowait;
+extern int maxirq;
+extern int maxsoftirq;
+extern int cpustat_count;
+extern int maxlatency;
+extern int maxlatency_p99;
+extern int latency_period;
+extern char *latency_cpus;
+extern int hung_timeout;
+extern int maxhung;
+extern int maxdstate;
+extern int proc_scan_max;
+extern int maxfileuse;
+extern int maxtaskuse;
+extern int maxzombieuse;
+extern int maxconntrackuse;
+extern int maxsocketuse;
 extern int minpages;
 extern int minalloc;
 extern int maxtemp;
 extern int pingcount;
 extern int temp_poweroff;
+extern int temp_autodetect;
+extern int temp_horizon;
+extern int temp_samples;
+extern int temp_alarm;
+extern int temp_alarm_interval;
 extern int sigterm_delay;
 extern int repair_max;
 
@@ -100,8 +242,42 @@ extern int realtime;
 
 extern struct list *tr_bin_list;
 extern struct list *file_list;
+extern int file_stat_interval;
+extern int stat_dont_sync;
+extern int stat_timeout;
+extern int mount_timeout;
+extern int mount_timeout_count;
+extern int mount_read;
+extern int disk_probe_interval;
+extern int disk_probe_timeout;
+extern int disk_probe_direct;
+extern int max_disk_latency;
+extern int max_disk_latency_p99;
+extern int disk_stall_time;
+extern int max_disk_await;
+extern int hw_errors;
+extern int hw_error_period;
+extern int max_corrected;
+extern int max_uncorrected;
+extern int time_jump_threshold;
+extern int time_jump_error;
+extern int cgroup_pressure;
+extern int cgroup_pressure_window;
+extern int cgroup_pressure_count;
+extern int cgroup_oom_error;
+extern int cgroup_empty_error;
+extern int cgroup_pressure_error;
 extern struct list *target_list;
 extern struct list *pidfile_list;
+extern struct list *process_list;
+extern struct list *mount_list;
+extern struct list *fs_list;
+extern struct list *mountwatch_list;
+extern struct list *kmsg_list;
+extern struct list *md_list;
+extern struct list *cgroup_list;
+extern struct list *disk_list;
+extern struct list *diskstats_list;
 extern struct list *iface_list;
 extern struct list *temp_list;
 
@@ -115,6 +291,9 @@ extern int verbose;
 /* From watchdog.c */
 extern char *filename_buf;
 
+/* From snapshot.c */
+extern struct snapshot sys_snap;
+
 /* From daemon-pid.c */
 extern pid_t daemon_pid;
 
@@ -128,8 +307,93 @@ extern pid_t daemon_pid;
 #endif				/*!__GNUC__ */
 #endif				/*!GCC_NORETURN */
 
+#ifndef GCC_UNUSED
+#ifdef __GNUC__
+#define GCC_UNUSED __attribute__((unused))
+#else
+#define GCC_UNUSED
+#endif				/*!__GNUC__ */
+#endif				/*!GCC_UNUSED */
+
+/** monotime.c **/
+long long clock_ns(clockid_t clk);
+time_t mono_seconds(void);
+long long mono_ms(void);
+long long mono_us(void);
+long long mono_ns(void);
+struct timeval;
+void mono_timeval(struct timeval *tv);
+
+/** histogram.c **/
+#define HIST_LINEAR		64
+#define HIST_SUB_BITS	3
+#define HIST_SUB		(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(HIST_LINEAR + (32 - 6) * HIST_SUB)
+int hist_bucket(unsigned int us);
+unsigned int hist_limit(int idx);
+unsigned int hist_percentile(const unsigned int *hist, int percent);
+
 /** file_stat.c **/
+int open_filecheck(struct list *flist);
 int check_file_stat(struct list *);
+int close_filecheck(void);
+void rebase_filecheck(void);
+
+/** mountresp.c **/
+int open_mountcheck(struct list *mlist);
+int check_mount(struct list *act);
+int close_mountcheck(void);
+
+/** diskprobe.c **/
+int open_diskprobe(struct list *dlist);
+int check_diskprobe(struct list *act);
+int close_diskprobe(void);
+
+/** cgroup.c **/
+int open_cgroupcheck(struct list *clist);
+int check_cgroup(struct list *act);
+int close_cgroupcheck(void);
+
+/** timejump.c **/
+int open_timecheck(void);
+int check_timejump(void);
+int close_timecheck(void);
+
+/** mdraid.c **/
+int open_mdcheck(struct list *mlist);
+int check_mdraid(struct list *act);
+int close_mdcheck(void);
+
+/** hwerror.c **/
+int open_hwerror(void);
+int check_hwerror(void);
+int close_hwerror(void);
+
+/** kmsg.c **/
+int open_kmsg(struct list *klist);
+int close_kmsg(void);
+
+/** mountwatch.c **/
+int open_mountwatch(struct list *mlist);
+int check_mountwatch(struct list *act);
+int close_mountwatch(void);
+
+/** fsspace.c **/
+int open_fscheck(struct list *flist);
+int check_fsspace(struct list *act);
+int close_fscheck(void);
+
+/** diskstats.c **/
+int open_diskstats(void);
+int check_diskstats(void);
+int close_diskstats(void);
+
+/** deadline.c **/
+typedef int (*deadline_func)(void *arg);
+struct deadline *open_deadline(void);
+int run_deadline(struct deadline *dl, deadline_func func, void *arg, long msec);
+int finish_deadline(struct deadline *dl);
+int close_deadline(struct deadline *dl);
 
 /** file_table.c **/
 int check_file_table(void);
@@ -147,11 +411,52 @@ int open_loadcheck(void);
 int check_load(void);
 int close_loadcheck(void);
 
+/** events.c **/
+typedef int (*event_func)(int fd, short revents, void *arg);
+int add_event_fd(int fd, short events, event_func func, void *arg, struct list *act);
+void remove_event_fd(int fd);
+void report_event(int result, struct list *act);
+void wait_for_events(unsigned long usec, void (*action)(int result, struct list *act));
+void close_events(void);
+
+/** fwatch.c **/
+typedef void (*fwatch_func)(void *arg, unsigned int mask);
+int add_file_watch(const char *path, fwatch_func func, void *arg);
+void close_file_watches(void);
+
+/** snapshot.c **/
+int open_snapshot(void);
+int update_snapshot(void);
+int close_snapshot(void);
+
+/** cpustat.c **/
+int open_cpustat(void);
+int check_cpustat(void);
+int close_cpustat(void);
+
+/** latency.c **/
+int open_latency(void);
+int check_latency(void);
+int close_latency(void);
+
+/** procscan.c **/
+int open_procscan(void);
+int update_procscan(void);
+int procscan_zombies(unsigned int *count);
+int check_hungtask(void);
+int close_procscan(void);
+
+/** headroom.c **/
+int open_headroom(void);
+int check_headroom(void);
+int close_headroom(void);
+
 /** net.c **/
 int check_net(char *target, int sock_fp, struct sockaddr to, unsigned char *packet, int time, int count);
 int open_netcheck(struct list *tlist);
 
 /** temp.c **/
+void find_temp_sensors(struct list **list);
 int open_tempcheck(struct list *tlist);
 int check_temp(struct list *act);
 int close_tempcheck(void);
@@ -161,7 +466,14 @@ int check_bin(char *, int, int);
 void free_process(void);
 
 /** pidfile.c **/
+int open_pidcheck(struct list *plist);
 int check_pidfile(struct list *);
+int close_pidcheck(void);
+
+/** procmon.c **/
+int open_proccheck(struct list *list);
+int check_process(struct list *act);
+int close_proccheck(void);
 
 /** iface.c **/
 int check_iface(struct list *);
@@ -20,6 +20,7 @@ void trim_white(char *buf);
 char *str_start(char *p);
 
 int read_int_func(char *arg, char *val, const char *name, int imin, int imax, int *iv);
+int read_fixed_func(char *arg, char *val, const char *name, int scale, int *iv);
 int read_string_func(char *arg, char *val, const char *name, string_read_e mode, char **str);
 int read_enumerated_func(char *arg, char *val, const char *name, const read_list_t list[], int *iv);
 
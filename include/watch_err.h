@@ -17,5 +17,16 @@
 #define ETOOLONG	247	/* child didn't return in time */
 #define EUSERVALUE	246	/* reserved for user error code */
 #define EDONTKNOW	245	/* unknown, not "no error" (i.e. success) but implies test still running */
+#define ECPUTIME	244	/* CPU steal, iowait or interrupt time too high */
+#define ELATENCY	243	/* scheduling latency too high on a CPU */
+#define ETEMPRISE	242	/* temperature predicted to reach the limit soon */
+#define ENOPROGRESS	241	/* process stuck or not doing any work */
+#define EHUNGTASK	240	/* too many tasks stuck in D state */
+#define EIOSLOW		239	/* disk writes too slow */
+#define EKMSG		238	/* kernel log message matched */
+#define EHWERR		237	/* too many hardware errors */
+#define EDEGRADED	236	/* RAID array degraded or failed */
+#define ETIMEJUMP	235	/* system clock was stepped */
+#define EPRESSURE	234	/* sustained memory pressure in a cgroup */
 
 #endif /*_WATCH_ERR_H*/
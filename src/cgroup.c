@@ -0,0 +1,295 @@
+/* > cgroup.c
+ *
+ * Code for checking services run in their own (version 2) cgroup, which the
+ * system wide memory checks can't see into. For each 'cgroup' directory:
+ *
+ *  - cgroup.events gives "populated 0" once no process is left in it;
+ *  - memory.events counts the processes killed by the OOM killer, and how
+ *    often the cgroup was throttled for going over memory.high;
+ *  - memory.pressure takes a trigger, so the kernel tells us when tasks in the
+ *    cgroup are stalled waiting for memory for more than a given time.
+ *
+ * The kernel notifies changes to the first two, so all three are in the main
+ * loop's ppoll() set for POLLPRI and nothing is read unless something happens.
+ * The per-interval check only reports the state the events left behind.
+ *
+ * Pressure is taken as sustained when the trigger fires in 'cgroup-pressure-count'
+ * windows in a row. Which error (if any) each problem gives is configurable.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+static int cgroup_event(int fd, short revents, void *arg);
+
+/* ============================================================================ */
+
+static int open_cgfile(struct list *act, const char *file, int flags)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", act->name, file);
+	return open(path, flags | O_CLOEXEC);
+}
+
+/*
+ * Read a "key value" file and set 'val' to the value for 'key' (or 0 if it is
+ * not there). Returns errno if the file can't be read, as once the cgroup has
+ * been removed.
+ */
+
+static int read_key(int fd, const char *key, long long *val)
+{
+	char buf[512], *ptr;
+	size_t len = strlen(key);
+	int n;
+
+	*val = 0;
+	if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) < 0)
+		return (errno);
+	buf[n] = 0;
+
+	for (ptr = buf; ptr != NULL && *ptr; ptr = strchr(ptr, '\n'), ptr = ptr ? ptr + 1 : NULL) {
+		if (strncmp(ptr, key, len) == 0 && ptr[len] == ' ') {
+			*val = strtoll(ptr + len + 1, NULL, 10);
+			break;
+		}
+	}
+
+	return (ENOERR);
+}
+
+static void drop_fd(int *fd)
+{
+	remove_event_fd(*fd);
+	close(*fd);
+	*fd = -1;
+}
+
+static void close_cg(struct cgroupmode *cg)
+{
+	if (cg->events_fd != -1)
+		drop_fd(&cg->events_fd);
+	if (cg->memev_fd != -1)
+		drop_fd(&cg->memev_fd);
+	if (cg->psi_fd != -1)
+		drop_fd(&cg->psi_fd);
+}
+
+/*
+ * Open the cgroup's files and add them to the main loop's ppoll() set. Returns
+ * errno if there is no cgroup.events, as when the cgroup does not exist (yet),
+ * which is taken as the cgroup having no processes.
+ */
+
+static int open_cg(struct list *act)
+{
+	struct cgroupmode *cg = &act->parameter.cgroup;
+	long long val;
+
+	close_cg(cg);
+	cg->streak = 0;
+	cg->last_psi = 0;
+	cg->populated = FALSE;
+
+	cg->events_fd = open_cgfile(act, "cgroup.events", O_RDONLY);
+	if (cg->events_fd == -1)
+		return (errno);
+
+	cg->memev_fd = open_cgfile(act, "memory.events", O_RDONLY);
+	if (cg->memev_fd == -1)
+		log_message(LOG_ERR, "cannot open %s/memory.events (errno = %d = '%s')", act->name, errno, strerror(errno));
+
+	/* Reading them once arms the notification. */
+	if (read_key(cg->events_fd, "populated", &val) == ENOERR)
+		cg->populated = (val != 0);
+	cg->oom_kill = cg->high = 0;
+	if (cg->memev_fd != -1) {
+		read_key(cg->memev_fd, "oom_kill", &cg->oom_kill);
+		read_key(cg->memev_fd, "high", &cg->high);
+	}
+
+	add_event_fd(cg->events_fd, POLLPRI, cgroup_event, act, act);
+	if (cg->memev_fd != -1)
+		add_event_fd(cg->memev_fd, POLLPRI, cgroup_event, act, act);
+
+	if (cgroup_pressure > 0) {
+		char trigger[64];
+		int len;
+
+		cg->psi_fd = open_cgfile(act, "memory.pressure", O_RDWR | O_NONBLOCK);
+		len = snprintf(trigger, sizeof(trigger), "some %ld %ld",
+			1000L * cgroup_pressure, 1000L * cgroup_pressure_window);
+		if (cg->psi_fd == -1 || write(cg->psi_fd, trigger, len + 1) < 0) {
+			log_message(LOG_ERR, "cannot set memory pressure trigger for %s (errno = %d = '%s')",
+				act->name, errno, strerror(errno));
+			if (cg->psi_fd != -1)
+				close(cg->psi_fd);
+			cg->psi_fd = -1;
+		}
+		if (cg->psi_fd != -1)
+			add_event_fd(cg->psi_fd, POLLPRI, cgroup_event, act, act);
+	}
+
+	return (ENOERR);
+}
+
+int open_cgroupcheck(struct list *clist)
+{
+	struct list *act;
+
+	for (act = clist; act != NULL; act = act->next) {
+		struct cgroupmode *cg = &act->parameter.cgroup;
+		int err;
+
+		cg->events_fd = cg->memev_fd = cg->psi_fd = -1;
+		if ((err = open_cg(act)) != ENOERR) {
+			log_message(LOG_ERR, "cannot find cgroup %s (errno = %d = '%s')", act->name, err, strerror(err));
+			continue;
+		}
+
+		if (verbose)
+			log_message(LOG_DEBUG, "cgroup %s is %s, %lld OOM kill(s)%s", act->name,
+				cg->populated ? "populated" : "empty", cg->oom_kill,
+				(cg->psi_fd != -1) ? ", watching memory pressure" : "");
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Called from the main loop's ppoll() when one of the cgroup's files has been
+ * notified, or its memory pressure trigger has fired.
+ */
+
+static int cgroup_event(int fd, short revents, void *arg)
+{
+	struct list *act = arg;
+	struct cgroupmode *cg = &act->parameter.cgroup;
+	long long val;
+
+	if (fd == cg->events_fd) {
+		if (read_key(fd, "populated", &val) != ENOERR) {
+			/* The cgroup has been removed, so nothing more will come from it. */
+			drop_fd(&cg->events_fd);
+			val = 0;
+		}
+		if (val == 0) {
+			if (cg->populated)
+				log_message(LOG_ERR, "cgroup %s has no processes left", act->name);
+			cg->populated = FALSE;
+			return (cgroup_empty_error);
+		}
+		cg->populated = TRUE;
+		return (ENOERR);
+	}
+
+	if (fd == cg->memev_fd) {
+		int err = ENOERR;
+
+		if (read_key(fd, "high", &val) != ENOERR) {
+			drop_fd(&cg->memev_fd);
+			return (ENOERR);
+		}
+		if (val > cg->high)
+			log_message(LOG_WARNING, "cgroup %s throttled for going over memory.high %lld time(s)",
+				act->name, val - cg->high);
+		cg->high = val;
+
+		read_key(fd, "oom_kill", &val);
+		if (val > cg->oom_kill) {
+			log_message(LOG_ERR, "%lld process(es) in cgroup %s killed by the OOM killer",
+				val - cg->oom_kill, act->name);
+			err = cgroup_oom_error;
+		}
+		cg->oom_kill = val;
+
+		return (err);
+	}
+
+	if (fd == cg->psi_fd) {
+		long long now = mono_ms();
+
+		if (revents & POLLERR) {
+			/* The cgroup has gone, cgroup.events reports that. */
+			drop_fd(&cg->psi_fd);
+			return (ENOERR);
+		}
+
+		/* The kernel fires at most once per window, so missing two means it has eased off. */
+		if (cg->last_psi != 0 && now - cg->last_psi <= 2LL * cgroup_pressure_window)
+			cg->streak++;
+		else
+			cg->streak = 1;
+		cg->last_psi = now;
+
+		if (verbose)
+			log_message(LOG_DEBUG, "cgroup %s memory pressure over %d ms in %d ms (%d in a row)",
+				act->name, cgroup_pressure, cgroup_pressure_window, cg->streak);
+
+		if (cg->streak >= cgroup_pressure_count) {
+			log_message(LOG_ERR, "cgroup %s under memory pressure for %d windows in a row",
+				act->name, cg->streak);
+			return (cgroup_pressure_error);
+		}
+	}
+
+	return (ENOERR);
+}
+
+int check_cgroup(struct list *act)
+{
+	struct cgroupmode *cg = &act->parameter.cgroup;
+
+	/* Look again for a cgroup that was missing or has been removed. */
+	if (cg->events_fd == -1 && open_cg(act) == ENOERR)
+		log_message(LOG_INFO, "cgroup %s is now present", act->name);
+
+	if (!cg->populated && cgroup_empty_error != ENOERR) {
+		if (cg->events_fd == -1)
+			log_message(LOG_ERR, "cgroup %s is not present", act->name);
+		else
+			log_message(LOG_ERR, "cgroup %s has no processes", act->name);
+		return (cgroup_empty_error);
+	}
+
+	if (cg->events_fd == -1)
+		return (ENOERR);
+
+	if (cg->streak >= cgroup_pressure_count && mono_ms() - cg->last_psi <= 2LL * cgroup_pressure_window)
+		return (cgroup_pressure_error);
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "cgroup %s populated, %lld OOM kill(s), %lld memory.high event(s)",
+			act->name, cg->oom_kill, cg->high);
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_cgroupcheck(void)
+{
+	struct list *act;
+
+	for (act = cgroup_list; act != NULL; act = act->next)
+		close_cg(&act->parameter.cgroup);
+
+	return 0;
+}
@@ -24,9 +24,36 @@
 #include "read-conf.h"
 
 static void add_test_binaries(const char *path);
+static struct list *last_entry(struct list *list, const char *type, const char *what, int linecount);
+static struct list *list_tail(struct list *list);
 
 #define ADMIN			"admin"
 #define CHANGE			"change"
+#define FILESTATINT		"file-stat-interval"
+#define STATDONTSYNC	"stat-dont-sync"
+#define STATTIMEOUT		"stat-timeout"
+#define MOUNTRESP		"mount-responsive"
+#define MOUNTTIMEOUT	"mount-timeout"
+#define MOUNTTIMECOUNT	"mount-timeout-count"
+#define MOUNTREAD		"mount-read"
+#define FSSPACE			"fs-space"
+#define MOUNTWRITABLE	"mount-writable"
+#define MDARRAY			"md-array"
+#define DISKPROBE		"disk-probe"
+#define DISKPROBEINT	"disk-probe-interval"
+#define DISKPROBETIME	"disk-probe-timeout"
+#define DISKPROBEDIRECT	"disk-probe-direct"
+#define MAXDISKLAT		"max-disk-latency"
+#define MAXDISKLATP99	"max-disk-latency-p99"
+#define DISKSTATSDEV	"diskstats-device"
+#define DISKSTALLTIME	"disk-stall-time"
+#define MAXDISKAWAIT	"max-disk-await"
+#define HWERRORS		"hw-errors"
+#define HWERRPERIOD		"hw-error-period"
+#define MAXCORRECTED	"max-corrected-errors"
+#define MAXUNCORRECTED	"max-uncorrected-errors"
+#define TIMEJUMPTHRESH	"time-jump-threshold"
+#define TIMEJUMPERROR	"time-jump-error"
 #define DEVICE			"watchdog-device"
 #define DEVICE_USE_SETTIMEOUT	"watchdog-refresh-use-settimeout"
 #define DEVICE_TIMEOUT		"watchdog-timeout"
@@ -37,10 +64,47 @@ static void add_test_binaries(const char *path);
 #define MAXLOAD1		"max-load-1"
 #define MAXLOAD5		"max-load-5"
 #define MAXLOAD15		"max-load-15"
+#define MAXLOAD1CPU		"max-load-1-per-cpu"
+#define MAXLOAD5CPU		"max-load-5-per-cpu"
+#define MAXLOAD15CPU	"max-load-15-per-cpu"
+#define MAXRUNNING		"max-procs-running"
+#define MAXBLOCKED		"max-procs-blocked"
+#define MAXSTEAL		"max-cpu-steal"
+#define MAXIOWAIT		"max-cpu-iowait"
+#define MAXIRQ			"max-cpu-irq"
+#define MAXSOFTIRQ		"max-cpu-softirq"
+#define CPUTIMECOUNT	"cpu-time-count"
+#define MAXLATENCY		"max-latency"
+#define MAXLATENCYP99	"max-latency-p99"
+#define LATENCYPERIOD	"latency-period"
+#define LATENCYCPUS		"latency-cpus"
+#define HUNGTIMEOUT		"hung-task-timeout"
+#define MAXHUNG			"max-hung-tasks"
+#define MAXDSTATE		"max-dstate-tasks"
+#define PROCSCANMAX		"proc-scan-max"
+#define MAXFILEUSE		"max-file-use"
+#define MAXTASKUSE		"max-task-use"
+#define MAXZOMBIEUSE	"max-zombie-use"
+#define MAXCONNTRACKUSE	"max-conntrack-use"
+#define MAXSOCKETUSE	"max-socket-use"
 #define MAXTEMP			"max-temperature"
 #define MINMEM			"min-memory"
 #define ALLOCMEM		"allocatable-memory"
 #define SERVERPIDFILE		"pidfile"
+#define PIDSTUCK		"pidfile-stuck"
+#define PIDPROGRESS		"pidfile-progress"
+#define PROCESS			"process"
+#define CGROUP			"cgroup"
+#define CGPRESSURE		"cgroup-pressure"
+#define CGPRESSWINDOW	"cgroup-pressure-window"
+#define CGPRESSCOUNT	"cgroup-pressure-count"
+#define CGOOMERROR		"cgroup-oom-error"
+#define CGEMPTYERROR	"cgroup-empty-error"
+#define CGPRESSERROR	"cgroup-pressure-error"
+#define KMSGPATTERN		"kmsg-pattern"
+#define KMSGERROR		"kmsg-error"
+#define KMSGCOUNT		"kmsg-count"
+#define KMSGPERIOD		"kmsg-period"
 #define PING			"ping"
 #define PINGCOUNT		"ping-count"
 #define PRIORITY		"priority"
@@ -50,6 +114,11 @@ static void add_test_binaries(const char *path);
 #define SOFTBOOT		"softboot-option"
 #define TEMP			"temperature-sensor"
 #define TEMPPOWEROFF   		"temp-power-off"
+#define TEMPAUTODETECT	"temp-autodetect"
+#define TEMPHORIZON		"temp-predict-horizon"
+#define TEMPSAMPLES		"temp-predict-samples"
+#define TEMPALARM		"temp-alarm"
+#define TEMPALARMINT	"temp-alarm-interval"
 #define TESTBIN			"test-binary"
 #define TESTTIMEOUT		"test-timeout"
 #define HEARTBEAT		"heartbeat-file"
@@ -75,11 +144,39 @@ int schedprio = 1;
 int maxload1 = 0;
 int maxload5 = 0;
 int maxload15 = 0;
+int maxload1_cpu = 0;
+int maxload5_cpu = 0;
+int maxload15_cpu = 0;
+int maxrunning = 0;
+int maxblocked = 0;
+int maxsteal = 0;
+int maxiowait = 0;
+int maxirq = 0;
+int maxsoftirq = 0;
+int cpustat_count = 3;
+int maxlatency = 0;
+int maxlatency_p99 = 0;
+int latency_period = 1000;	/* Canary thread wake-up period in microseconds. */
+char *latency_cpus = NULL;
+int hung_timeout = 0;
+int maxhung = 0;
+int maxdstate = 0;
+int proc_scan_max = 5000;	/* Processes looked at per interval. */
+int maxfileuse = 0;			/* Percentages of the kernel limits. */
+int maxtaskuse = 0;
+int maxzombieuse = 0;
+int maxconntrackuse = 0;
+int maxsocketuse = 0;
 int minpages = 0;
 int minalloc = 0;
 int maxtemp = 90;
 int pingcount = 3;
 int temp_poweroff = TRUE;
+int temp_autodetect = FALSE;
+int temp_horizon = 0;	/* Seconds ahead to predict reaching max-temperature. */
+int temp_samples = 10;
+int temp_alarm = FALSE;
+int temp_alarm_interval = 30;	/* Intervals between samples of sensors with alarms. */
 int sigterm_delay = 5;	/* Seconds from first SIGTERM to sending SIGKILL during shutdown. */
 int repair_max = 1; /* Number of repair attempts without success. */
 
@@ -102,8 +199,42 @@ int realtime = FALSE;
 /* Self-repairing binaries list */
 struct list *tr_bin_list = NULL;
 struct list *file_list = NULL;
+int file_stat_interval = 300;	/* Seconds between stat() of watched files. */
+int stat_dont_sync = FALSE;
+int stat_timeout = 5;		/* Seconds to wait for stat() on network file systems. */
+int mount_timeout = 5;
+int mount_timeout_count = 3;
+int mount_read = FALSE;
+int disk_probe_interval = 10;
+int disk_probe_timeout = 10;
+int disk_probe_direct = FALSE;
+int max_disk_latency = 0;		/* milliseconds */
+int max_disk_latency_p99 = 0;
+int disk_stall_time = 0;
+int max_disk_await = 0;		/* milliseconds */
+int hw_errors = FALSE;
+int hw_error_period = 3600;	/* Seconds over which corrected errors are counted. */
+int max_corrected = 0;
+int max_uncorrected = 0;
+int time_jump_threshold = 60;	/* Seconds of clock step that are logged. */
+int time_jump_error = FALSE;
+int cgroup_pressure = 0;		/* milliseconds stalled per window */
+int cgroup_pressure_window = 1000;
+int cgroup_pressure_count = 5;
+int cgroup_oom_error = ENOMEM;
+int cgroup_empty_error = ESRCH;
+int cgroup_pressure_error = EPRESSURE;
 struct list *target_list = NULL;
 struct list *pidfile_list = NULL;
+struct list *process_list = NULL;
+struct list *mount_list = NULL;
+struct list *fs_list = NULL;
+struct list *mountwatch_list = NULL;
+struct list *kmsg_list = NULL;
+struct list *md_list = NULL;
+struct list *cgroup_list = NULL;
+struct list *disk_list = NULL;
+struct list *diskstats_list = NULL;
 struct list *iface_list = NULL;
 struct list *temp_list = NULL;
 
@@ -134,6 +265,7 @@ READ_LIST_END()
  */
 
 #define READ_INT(name, iv)		read_int_func(		 arg, val, name, 0, 0, iv)
+#define READ_LOAD(name, iv)		read_fixed_func(	 arg, val, name, LOAD_SCALE, iv)
 #define READ_STRING(name, str)	read_string_func(	 arg, val, name, Read_allow_blank, str)
 #define READ_YESNO(name, iv)	read_enumerated_func(arg, val, name, Yes_No_list, iv)
 #define READ_YN_AUTO(name, iv)	read_enumerated_func(arg, val, name, YN_Auto_list, iv)
@@ -151,6 +283,7 @@ void read_config(char *configfile)
 	int linecount = 0;
 
 	maxload5 = maxload15 = 0;
+	maxload5_cpu = maxload15_cpu = 0;
 
 	if ((wc = fopen(configfile, "r")) == NULL) {
 		fatal_error(EX_SYSERR, "Can't open config file \"%s\" (%s)", configfile, strerror(errno));
@@ -199,7 +332,73 @@ void read_config(char *configfile)
 
 				ptr->parameter.file.mtime = itmp;
 			}
+		} else if (READ_INT(FILESTATINT, &file_stat_interval) == 0) {
+		} else if (READ_YESNO(STATDONTSYNC, &stat_dont_sync) == 0) {
+		} else if (READ_INT(STATTIMEOUT, &stat_timeout) == 0) {
+		} else if (READ_LIST(MOUNTRESP, &mount_list) == 0) {
+		} else if (READ_INT(MOUNTTIMEOUT, &mount_timeout) == 0) {
+		} else if (READ_INT(MOUNTTIMECOUNT, &mount_timeout_count) == 0) {
+		} else if (READ_YESNO(MOUNTREAD, &mount_read) == 0) {
+		} else if (READ_LIST(FSSPACE, &fs_list) == 0) {
+			struct list *ptr = list_tail(fs_list);
+			if (ptr != NULL)
+				ptr->parameter.fs.fd = -1;
+		} else if (READ_LIST(MOUNTWRITABLE, &mountwatch_list) == 0) {
+		} else if (READ_LIST(MDARRAY, &md_list) == 0) {
+			struct list *ptr = list_tail(md_list);
+			if (ptr != NULL)
+				ptr->parameter.md.state_fd = ptr->parameter.md.degraded_fd = ptr->parameter.md.action_fd = -1;
+		} else if (READ_LIST(DISKPROBE, &disk_list) == 0) {
+		} else if (READ_INT(DISKPROBEINT, &disk_probe_interval) == 0) {
+		} else if (READ_INT(DISKPROBETIME, &disk_probe_timeout) == 0) {
+		} else if (READ_YESNO(DISKPROBEDIRECT, &disk_probe_direct) == 0) {
+		} else if (READ_INT(MAXDISKLAT, &max_disk_latency) == 0) {
+		} else if (READ_INT(MAXDISKLATP99, &max_disk_latency_p99) == 0) {
+		} else if (READ_LIST(DISKSTATSDEV, &diskstats_list) == 0) {
+		} else if (READ_INT(DISKSTALLTIME, &disk_stall_time) == 0) {
+		} else if (READ_INT(MAXDISKAWAIT, &max_disk_await) == 0) {
+		} else if (READ_YESNO(HWERRORS, &hw_errors) == 0) {
+		} else if (READ_INT(HWERRPERIOD, &hw_error_period) == 0) {
+		} else if (READ_INT(MAXCORRECTED, &max_corrected) == 0) {
+		} else if (READ_INT(MAXUNCORRECTED, &max_uncorrected) == 0) {
+		} else if (READ_INT(TIMEJUMPTHRESH, &time_jump_threshold) == 0) {
+		} else if (READ_YESNO(TIMEJUMPERROR, &time_jump_error) == 0) {
 		} else if (READ_LIST(SERVERPIDFILE, &pidfile_list) == 0) {
+			struct list *ptr = list_tail(pidfile_list);
+			if (ptr != NULL)
+				ptr->parameter.pid.pidfd = ptr->parameter.pid.stat_fd = ptr->parameter.pid.io_fd = -1;
+		} else if (READ_INT(PIDSTUCK, &itmp) == 0) {
+			struct list *ptr = last_entry(pidfile_list, SERVERPIDFILE, PIDSTUCK, linecount);
+			if (ptr != NULL)
+				ptr->parameter.pid.stuck = itmp;
+		} else if (READ_INT(PIDPROGRESS, &itmp) == 0) {
+			struct list *ptr = last_entry(pidfile_list, SERVERPIDFILE, PIDPROGRESS, linecount);
+			if (ptr != NULL)
+				ptr->parameter.pid.progress = itmp;
+		} else if (READ_LIST(PROCESS, &process_list) == 0) {
+		} else if (READ_LIST(CGROUP, &cgroup_list) == 0) {
+			struct list *ptr = list_tail(cgroup_list);
+			if (ptr != NULL)
+				ptr->parameter.cgroup.events_fd = ptr->parameter.cgroup.memev_fd = ptr->parameter.cgroup.psi_fd = -1;
+		} else if (READ_INT(CGPRESSURE, &cgroup_pressure) == 0) {
+		} else if (READ_INT(CGPRESSWINDOW, &cgroup_pressure_window) == 0) {
+		} else if (READ_INT(CGPRESSCOUNT, &cgroup_pressure_count) == 0) {
+		} else if (READ_INT(CGOOMERROR, &cgroup_oom_error) == 0) {
+		} else if (READ_INT(CGEMPTYERROR, &cgroup_empty_error) == 0) {
+		} else if (READ_INT(CGPRESSERROR, &cgroup_pressure_error) == 0) {
+		} else if (READ_LIST(KMSGPATTERN, &kmsg_list) == 0) {
+		} else if (READ_INT(KMSGERROR, &itmp) == 0) {
+			struct list *ptr = last_entry(kmsg_list, KMSGPATTERN, KMSGERROR, linecount);
+			if (ptr != NULL)
+				ptr->parameter.kmsg.code = itmp;
+		} else if (READ_INT(KMSGCOUNT, &itmp) == 0) {
+			struct list *ptr = last_entry(kmsg_list, KMSGPATTERN, KMSGCOUNT, linecount);
+			if (ptr != NULL)
+				ptr->parameter.kmsg.count = itmp;
+		} else if (READ_INT(KMSGPERIOD, &itmp) == 0) {
+			struct list *ptr = last_entry(kmsg_list, KMSGPATTERN, KMSGPERIOD, linecount);
+			if (ptr != NULL)
+				ptr->parameter.kmsg.period = itmp;
 		} else if (READ_INT(PINGCOUNT, &pingcount) == 0) {
 		} else if (READ_LIST(PING, &target_list) == 0) {
 		} else if (READ_LIST(INTERFACE, &iface_list) == 0) {
@@ -219,16 +418,47 @@ void read_config(char *configfile)
 		} else if (READ_YN_AUTO(DEVICE_USE_SETTIMEOUT, &refresh_use_settimeout) == 0) {
 		} else if (READ_INT(DEVICE_TIMEOUT, &dev_timeout) == 0) {
 		} else if (READ_LIST(TEMP, &temp_list) == 0) {
+			struct list *ptr = list_tail(temp_list);
+			if (ptr != NULL)
+				ptr->parameter.temp.fd = ptr->parameter.temp.alarm_fd = ptr->parameter.temp.crit_alarm_fd = -1;
 		} else if (READ_INT(MAXTEMP, &maxtemp) == 0) {
-		} else if (READ_INT(MAXLOAD1, &maxload1) == 0) {
-		} else if (READ_INT(MAXLOAD5, &maxload5) == 0) {
-		} else if (READ_INT(MAXLOAD15, &maxload15) == 0) {
+		} else if (READ_LOAD(MAXLOAD1, &maxload1) == 0) {
+		} else if (READ_LOAD(MAXLOAD5, &maxload5) == 0) {
+		} else if (READ_LOAD(MAXLOAD15, &maxload15) == 0) {
+		} else if (READ_LOAD(MAXLOAD1CPU, &maxload1_cpu) == 0) {
+		} else if (READ_LOAD(MAXLOAD5CPU, &maxload5_cpu) == 0) {
+		} else if (READ_LOAD(MAXLOAD15CPU, &maxload15_cpu) == 0) {
+		} else if (READ_INT(MAXRUNNING, &maxrunning) == 0) {
+		} else if (READ_INT(MAXBLOCKED, &maxblocked) == 0) {
+		} else if (READ_INT(MAXSTEAL, &maxsteal) == 0) {
+		} else if (READ_INT(MAXIOWAIT, &maxiowait) == 0) {
+		} else if (READ_INT(MAXIRQ, &maxirq) == 0) {
+		} else if (READ_INT(MAXSOFTIRQ, &maxsoftirq) == 0) {
+		} else if (READ_INT(CPUTIMECOUNT, &cpustat_count) == 0) {
+		} else if (READ_INT(MAXLATENCY, &maxlatency) == 0) {
+		} else if (READ_INT(MAXLATENCYP99, &maxlatency_p99) == 0) {
+		} else if (READ_INT(LATENCYPERIOD, &latency_period) == 0) {
+		} else if (READ_STRING(LATENCYCPUS, &latency_cpus) == 0) {
+		} else if (READ_INT(HUNGTIMEOUT, &hung_timeout) == 0) {
+		} else if (READ_INT(MAXHUNG, &maxhung) == 0) {
+		} else if (READ_INT(MAXDSTATE, &maxdstate) == 0) {
+		} else if (READ_INT(PROCSCANMAX, &proc_scan_max) == 0) {
+		} else if (READ_INT(MAXFILEUSE, &maxfileuse) == 0) {
+		} else if (READ_INT(MAXTASKUSE, &maxtaskuse) == 0) {
+		} else if (READ_INT(MAXZOMBIEUSE, &maxzombieuse) == 0) {
+		} else if (READ_INT(MAXCONNTRACKUSE, &maxconntrackuse) == 0) {
+		} else if (READ_INT(MAXSOCKETUSE, &maxsocketuse) == 0) {
 		} else if (READ_INT(MINMEM, &minpages) == 0) {
 		} else if (READ_INT(ALLOCMEM, &minalloc) == 0) {
 		} else if (READ_STRING(LOGDIR, &logdir) == 0) {
 		} else if (READ_STRING(TESTDIR, &test_dir) == 0) {
 		} else if (READ_YESNO(SOFTBOOT, &softboot) == 0) {
 		} else if (READ_YESNO(TEMPPOWEROFF, &temp_poweroff) == 0) {
+		} else if (READ_YESNO(TEMPAUTODETECT, &temp_autodetect) == 0) {
+		} else if (READ_INT(TEMPHORIZON, &temp_horizon) == 0) {
+		} else if (READ_INT(TEMPSAMPLES, &temp_samples) == 0) {
+		} else if (READ_YESNO(TEMPALARM, &temp_alarm) == 0) {
+		} else if (READ_INT(TEMPALARMINT, &temp_alarm_interval) == 0) {
 		} else if (READ_INT(SIGTERM_DELAY, &sigterm_delay) == 0) {
 		} else if (READ_INT(RETRYTIMEOUT, &retry_timeout) == 0) {
 		} else if (READ_INT(REPAIRMAX, &repair_max) == 0) {
@@ -258,6 +488,43 @@ void read_config(char *configfile)
 	if (maxload1 && !maxload15)
 		maxload15 = maxload1 / 2;
 
+	if (maxload1_cpu && !maxload5_cpu)
+		maxload5_cpu = maxload1_cpu * 3 / 4;
+
+	if (maxload1_cpu && !maxload15_cpu)
+		maxload15_cpu = maxload1_cpu / 2;
+
+}
+
+/*
+ * Options like 'pidfile-stuck' apply to the last 'pidfile' given, as 'change' does to 'file'.
+ */
+
+static struct list *last_entry(struct list *list, const char *type, const char *what, int linecount)
+{
+	if (list == NULL) {
+		log_message(LOG_WARNING,
+			"Warning: %s given, but no %s (yet) at line %d of config file", what, type, linecount);
+		return NULL;
+	}
+
+	return list_tail(list);
+}
+
+/*
+ * Return the last entry in a list, or NULL if it is empty. Used to mark the
+ * descriptors of a new entry as not open (-1), as xcalloc() leaves them at 0.
+ */
+
+static struct list *list_tail(struct list *list)
+{
+	struct list *ptr;
+
+	for (ptr = list; ptr != NULL && ptr->next != NULL; ptr = ptr->next) {
+		/* loop to find end of list. */
+	}
+
+	return ptr;
 }
 
 static void add_test_binaries(const char *path)
@@ -0,0 +1,268 @@
+/* > cpustat.c
+ *
+ * Code for checking the share of CPU time lost to hypervisor steal, I/O wait,
+ * and hard & soft interrupt processing. On virtual machines high steal time, or
+ * a single CPU stuck in softirq, is often a better sign of a sick host than the
+ * load average.
+ *
+ * The per-CPU counters come from /proc/stat, as read once per interval by the
+ * snapshot code, and the percentages are worked out from the change since the
+ * last interval. The counters are held as one array per field (rather than one
+ * structure per CPU) so the difference & threshold calculations are simple loops
+ * the compiler can vectorise, even for hundreds of CPUs.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+/* Fields we use from a "cpuN" line of /proc/stat (all in USER_HZ ticks). */
+enum {
+	CT_TOTAL = 0,
+	CT_IOWAIT,
+	CT_IRQ,
+	CT_SOFTIRQ,
+	CT_STEAL,
+	CT_NUM
+};
+
+static const char *ct_names[CT_NUM] = { "total", "iowait", "irq", "softirq", "steal" };
+
+struct cpu_counters {
+	unsigned long long *val[CT_NUM];
+	unsigned char *seen;			/* CPU was listed (i.e. on-line) */
+};
+
+static int cpustat_in_use = FALSE;
+static int nslots = 0;				/* slot 0 is the aggregate "cpu" line, slot N+1 is cpuN */
+static struct cpu_counters counts[2];
+static int cur = 0;					/* which of counts[] is the current reading */
+static unsigned long long *delta[CT_NUM];
+static unsigned char *over;			/* which thresholds each slot exceeded this interval */
+static int *over_count;				/* consecutive intervals each slot has been over */
+
+static int parse_stat(struct cpu_counters *cc, const char *text);
+
+/* ============================================================================ */
+
+int open_cpustat(void)
+{
+	int ii, jj;
+	long ncpus;
+
+	close_cpustat();
+
+	if (maxsteal <= 0 && maxiowait <= 0 && maxirq <= 0 && maxsoftirq <= 0)
+		return -1;
+
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (ncpus < 1)
+		ncpus = 1;
+
+	nslots = (int)ncpus + 1;
+	for (ii = 0; ii < 2; ii++) {
+		for (jj = 0; jj < CT_NUM; jj++)
+			counts[ii].val[jj] = xcalloc(nslots, sizeof(unsigned long long));
+		counts[ii].seen = xcalloc(nslots, sizeof(unsigned char));
+	}
+
+	for (jj = 0; jj < CT_NUM; jj++)
+		delta[jj] = xcalloc(nslots, sizeof(unsigned long long));
+
+	over = xcalloc(nslots, sizeof(unsigned char));
+	over_count = xcalloc(nslots, sizeof(int));
+
+	cur = 0;
+	cpustat_in_use = TRUE;
+	return 0;
+}
+
+/* ============================================================================ */
+
+int check_cpustat(void)
+{
+	struct cpu_counters *now, *last;
+	unsigned long long *dt;
+	int ii, jj, err = ENOERR;
+	const int thr[CT_NUM] = { 0, maxiowait, maxirq, maxsoftirq, maxsteal };
+
+	if (!cpustat_in_use || !sys_snap.valid || sys_snap.stat_text == NULL)
+		return (ENOERR);
+
+	cur ^= 1;
+	now  = &counts[cur];
+	last = &counts[cur ^ 1];
+
+	if ((err = parse_stat(now, sys_snap.stat_text)) != ENOERR)
+		return (err);
+
+	/*
+	 * Differences since the last interval, one field at a time. The per-CPU iowait
+	 * count is known to go backwards at times, so clamp at zero rather than wrap.
+	 */
+	for (jj = 0; jj < CT_NUM; jj++) {
+		const unsigned long long *a = now->val[jj], *b = last->val[jj];
+		unsigned long long *d = delta[jj];
+
+		for (ii = 0; ii < nslots; ii++)
+			d[ii] = (a[ii] > b[ii]) ? a[ii] - b[ii] : 0;
+	}
+
+	/*
+	 * Build a bit-mask of thresholds exceeded per slot. The test "100 * d > thr * total"
+	 * avoids any division. CPUs that were not on-line for both readings are skipped.
+	 */
+	dt = delta[CT_TOTAL];
+	for (ii = 0; ii < nslots; ii++)
+		over[ii] = now->seen[ii] & last->seen[ii];
+
+	for (jj = 1; jj < CT_NUM; jj++) {
+		const unsigned long long *d = delta[jj];
+		const unsigned long long t = thr[jj];
+
+		if (thr[jj] <= 0)
+			continue;
+
+		for (ii = 0; ii < nslots; ii++)
+			over[ii] |= (100 * d[ii] > t * dt[ii]) << jj;
+	}
+
+	for (ii = 0; ii < nslots; ii++) {
+		if ((over[ii] & 1) == 0 || over[ii] == 1) {
+			/* Not valid, or no threshold exceeded. */
+			over_count[ii] = 0;
+			continue;
+		}
+
+		if (++over_count[ii] < cpustat_count)
+			continue;
+
+		for (jj = 1; jj < CT_NUM; jj++) {
+			if (over[ii] & (1 << jj)) {
+				char cpu[24];
+				if (ii == 0)
+					strcpy(cpu, "all CPUs");
+				else
+					snprintf(cpu, sizeof(cpu), "CPU %d", ii - 1);
+
+				log_message(LOG_ERR, "%s time %llu%% on %s is more than %d%% for %d intervals",
+					ct_names[jj], dt[ii] ? 100 * delta[jj][ii] / dt[ii] : 0ULL, cpu, thr[jj], over_count[ii]);
+			}
+		}
+		err = ECPUTIME;
+	}
+
+	if (verbose && logtick && ticker == 1 && last->seen[0] && dt[0] > 0) {
+		log_message(LOG_DEBUG, "CPU time is %llu%% iowait, %llu%% irq, %llu%% softirq, %llu%% steal",
+			100 * delta[CT_IOWAIT][0] / dt[0], 100 * delta[CT_IRQ][0] / dt[0],
+			100 * delta[CT_SOFTIRQ][0] / dt[0], 100 * delta[CT_STEAL][0] / dt[0]);
+	}
+
+	return (err);
+}
+
+/* ============================================================================ */
+
+int close_cpustat(void)
+{
+	int ii, jj;
+
+	if (cpustat_in_use) {
+		for (ii = 0; ii < 2; ii++) {
+			for (jj = 0; jj < CT_NUM; jj++)
+				free(counts[ii].val[jj]);
+			free(counts[ii].seen);
+		}
+
+		for (jj = 0; jj < CT_NUM; jj++)
+			free(delta[jj]);
+
+		free(over);
+		free(over_count);
+	}
+
+	memset(counts, 0, sizeof(counts));
+	memset(delta, 0, sizeof(delta));
+	over = NULL;
+	over_count = NULL;
+	nslots = 0;
+	cpustat_in_use = FALSE;
+	return 0;
+}
+
+/* ============================================================================ */
+
+static const char *read_number(const char *p, unsigned long long *val)
+{
+	unsigned long long v = 0;
+
+	while (*p == ' ')
+		p++;
+
+	while (*p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+
+	*val = v;
+	return p;
+}
+
+/*
+ * Parse the "cpu" lines at the start of /proc/stat, which are of the form:
+ *
+ * cpu3 user nice system idle iowait irq softirq steal guest guest_nice
+ *
+ * Note that guest time is already included in user time so is not added to the total.
+ */
+
+static int parse_stat(struct cpu_counters *cc, const char *text)
+{
+	const char *p = text;
+
+	memset(cc->seen, 0, nslots);
+
+	while (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+		unsigned long long v[8];
+		int slot = 0, ii;
+
+		p += 3;
+		if (*p != ' ') {
+			unsigned long long id;
+			p = read_number(p, &id);
+			slot = (int)id + 1;
+		}
+
+		for (ii = 0; ii < 8; ii++)
+			p = read_number(p, &v[ii]);
+
+		if (slot < nslots) {
+			cc->val[CT_TOTAL][slot]   = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+			cc->val[CT_IOWAIT][slot]  = v[4];
+			cc->val[CT_IRQ][slot]     = v[5];
+			cc->val[CT_SOFTIRQ][slot] = v[6];
+			cc->val[CT_STEAL][slot]   = v[7];
+			cc->seen[slot] = 1;
+		}
+
+		/* move to the start of the next line */
+		p = strchr(p, '\n');
+		if (p == NULL)
+			break;
+		p++;
+	}
+
+	if (cc->seen[0] == 0) {
+		log_message(LOG_ERR, "/proc/stat contains invalid data");
+		return (ENOLOAD);
+	}
+
+	return (ENOERR);
+}
@@ -0,0 +1,224 @@
+/* > deadline.c
+ *
+ * Code for running a call that might block for a long time, such as a stat()
+ * on an NFS mount whose server has gone away, without holding up the main loop
+ * and so the refreshing of the watchdog device.
+ *
+ * Each target gets its own helper thread that is started once and then waits
+ * for work. The main loop hands it a function to call and waits for the result
+ * only until the deadline. If the call has not returned by then ETIMEDOUT is
+ * reported, and again on each later attempt for as long as the thread is still
+ * stuck, but nothing else is held up. Once the call does return the thread is
+ * ready for use again.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+enum { DL_IDLE = 0, DL_QUEUED, DL_RUNNING, DL_DONE };
+
+struct deadline {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* uses CLOCK_MONOTONIC */
+	int state;
+	int quit;
+	int orphan;					/* closed while stuck, thread frees itself */
+	deadline_func func;
+	void *arg;
+	int result;
+};
+
+/* ============================================================================ */
+
+static void deadline_destroy(struct deadline *dl)
+{
+	pthread_mutex_destroy(&dl->lock);
+	pthread_cond_destroy(&dl->cond);
+	free(dl);
+}
+
+static void *deadline_thread(void *arg)
+{
+	struct deadline *dl = arg;
+	int orphan;
+
+	pthread_mutex_lock(&dl->lock);
+
+	for (;;) {
+		int result;
+
+		while (!dl->quit && dl->state != DL_QUEUED)
+			pthread_cond_wait(&dl->cond, &dl->lock);
+
+		if (dl->quit)
+			break;
+
+		dl->state = DL_RUNNING;
+		pthread_mutex_unlock(&dl->lock);
+
+		result = dl->func(dl->arg);
+
+		pthread_mutex_lock(&dl->lock);
+		dl->result = result;
+		dl->state = DL_DONE;
+		pthread_cond_broadcast(&dl->cond);
+	}
+
+	orphan = dl->orphan;
+	pthread_mutex_unlock(&dl->lock);
+
+	/* If we were stuck when told to quit then nobody is waiting to clean up. */
+	if (orphan)
+		deadline_destroy(dl);
+
+	return NULL;
+}
+
+/*
+ * Start a helper thread. Returns NULL if that is not possible, in which case the
+ * caller should make its calls directly.
+ */
+
+struct deadline *open_deadline(void)
+{
+	struct deadline *dl = xcalloc(1, sizeof(struct deadline));
+	pthread_condattr_t cattr;
+	pthread_attr_t attr;
+	int err;
+
+	pthread_mutex_init(&dl->lock, NULL);
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dl->cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 65536);
+	err = pthread_create(&dl->thread, &attr, deadline_thread, dl);
+	pthread_attr_destroy(&attr);
+
+	if (err != 0) {
+		log_message(LOG_ERR, "cannot start helper thread (errno = %d = '%s')", err, strerror(err));
+		deadline_destroy(dl);
+		return NULL;
+	}
+
+	return dl;
+}
+
+/* ============================================================================ */
+
+/*
+ * Have the helper call func(arg), waiting no more than 'msec' milliseconds for it
+ * to return. Returns what func() did, or ETIMEDOUT. Note that 'arg' must stay
+ * valid until a later call returns something other than ETIMEDOUT, and must only
+ * be looked at by the caller once it has.
+ */
+
+int run_deadline(struct deadline *dl, deadline_func func, void *arg, long msec)
+{
+	struct timespec end;
+	int result = ETIMEDOUT;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec  += msec / 1000;
+	end.tv_nsec += (msec % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_nsec -= 1000000000L;
+		end.tv_sec++;
+	}
+
+	pthread_mutex_lock(&dl->lock);
+
+	/* Still stuck on the last call? */
+	if (dl->state == DL_QUEUED || dl->state == DL_RUNNING) {
+		pthread_mutex_unlock(&dl->lock);
+		return (ETIMEDOUT);
+	}
+
+	dl->func = func;
+	dl->arg = arg;
+	dl->state = DL_QUEUED;
+	pthread_cond_broadcast(&dl->cond);
+
+	while (dl->state != DL_DONE) {
+		if (pthread_cond_timedwait(&dl->cond, &dl->lock, &end) == ETIMEDOUT)
+			break;
+	}
+
+	if (dl->state == DL_DONE) {
+		result = dl->result;
+		dl->state = DL_IDLE;
+	}
+
+	pthread_mutex_unlock(&dl->lock);
+	return (result);
+}
+
+/*
+ * Collect the result of a call that run_deadline() gave up waiting for. Returns
+ * ETIMEDOUT while it is still running, else what func() returned (or ENOERR if
+ * there was nothing to collect). After this 'arg' may be looked at again.
+ */
+
+int finish_deadline(struct deadline *dl)
+{
+	int result = ENOERR;
+
+	pthread_mutex_lock(&dl->lock);
+
+	if (dl->state == DL_QUEUED || dl->state == DL_RUNNING) {
+		result = ETIMEDOUT;
+	} else if (dl->state == DL_DONE) {
+		result = dl->result;
+		dl->state = DL_IDLE;
+	}
+
+	pthread_mutex_unlock(&dl->lock);
+	return (result);
+}
+
+/* ============================================================================ */
+
+/*
+ * Stop the helper. If it is stuck it is left to tidy up after itself if the
+ * call it is making ever returns, and -1 is returned so the caller knows not
+ * to free anything the call uses.
+ */
+
+int close_deadline(struct deadline *dl)
+{
+	int busy;
+
+	if (dl == NULL)
+		return 0;
+
+	pthread_mutex_lock(&dl->lock);
+	dl->quit = TRUE;
+	busy = (dl->state == DL_QUEUED || dl->state == DL_RUNNING);
+	dl->orphan = busy;
+	pthread_cond_broadcast(&dl->cond);
+	pthread_mutex_unlock(&dl->lock);
+
+	if (busy) {
+		pthread_detach(dl->thread);
+		return -1;
+	}
+
+	pthread_join(dl->thread, NULL);
+	deadline_destroy(dl);
+	return 0;
+}
@@ -0,0 +1,238 @@
+/* > diskprobe.c
+ *
+ * Code for timing a small synchronous write on each configured file system.
+ * A dying disk or a wedged controller can leave everything else looking fine
+ * while any write blocks for tens of seconds.
+ *
+ * Each 'disk-probe' names a file that is created (and the first block allocated)
+ * when first used. Every 'disk-probe-interval' seconds one block is written to
+ * it and fdatasync() called, optionally with O_DIRECT so the page cache is
+ * bypassed as well. As a write that hangs would hang the caller, all calls on
+ * the file are made from a helper thread (see deadline.c).
+ *
+ * The time taken is kept in a log-linear histogram (see histogram.c) for each
+ * probe that slowly forgets old results, and both the latest time and the 99th
+ * percentile of the histogram are checked against their limits. A write that
+ * times out is added once it does complete, so the slowest writes are counted.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE		/* For O_DIRECT */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define PROBE_SIZE		4096		/* also the O_DIRECT alignment */
+#define PROBE_DECAY		64			/* probes between halving the histogram */
+
+struct diskprobe {
+	struct deadline *dl;
+	const char *name;
+	int fd;						/* only used in the helper */
+	int direct;					/* O_DIRECT in use */
+	int direct_failed;			/* O_DIRECT not supported, note to log it */
+	unsigned char *buf;
+	unsigned long seq;
+	long job_us;				/* -1 until the write completes */
+	int late;					/* last write timed out, result not collected */
+	time_t next;				/* monotonic time of next probe */
+	unsigned int hist[HIST_BUCKETS];
+	unsigned int nprobes;
+};
+
+/* ============================================================================ */
+
+int open_diskprobe(struct list *dlist)
+{
+	struct list *act;
+
+	if (disk_probe_timeout <= 0)
+		disk_probe_timeout = 10;
+
+	for (act = dlist; act != NULL; act = act->next) {
+		struct diskprobe *dp = xcalloc(1, sizeof(struct diskprobe));
+
+		dp->name = act->name;
+		dp->fd = -1;
+		dp->direct = disk_probe_direct;
+		if (posix_memalign((void **)&dp->buf, PROBE_SIZE, PROBE_SIZE) != 0) {
+			log_message(LOG_ERR, "cannot allocate buffer for disk probe %s", act->name);
+			free(dp);
+			continue;
+		}
+		memset(dp->buf, 0, PROBE_SIZE);
+
+		dp->dl = open_deadline();
+		if (dp->dl == NULL) {
+			log_message(LOG_ERR, "disk probe %s will not be used", act->name);
+			free(dp->buf);
+			free(dp);
+			continue;
+		}
+
+		act->parameter.disk.probe = dp;
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/* Called in the helper thread. */
+static int probe_job(void *arg)
+{
+	struct diskprobe *dp = arg;
+	long long start;
+
+	if (dp->fd == -1) {
+		int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+
+		dp->fd = open(dp->name, flags | (dp->direct ? O_DIRECT : 0), 0600);
+		if (dp->fd == -1 && dp->direct && errno == EINVAL) {
+			/* Not supported by this file system (e.g. tmpfs). */
+			dp->direct = FALSE;
+			dp->direct_failed = TRUE;
+			dp->fd = open(dp->name, flags, 0600);
+		}
+		if (dp->fd == -1)
+			return errno;
+
+		/* Not fatal if this fails, the first write will allocate it. */
+		(void)posix_fallocate(dp->fd, 0, PROBE_SIZE);
+	}
+
+	/* Write something different each time. */
+	dp->seq++;
+	memcpy(dp->buf, &dp->seq, sizeof(dp->seq));
+
+	start = mono_us();
+
+	if (pwrite(dp->fd, dp->buf, PROBE_SIZE, 0) != PROBE_SIZE)
+		return (errno != 0) ? errno : EIO;
+
+	if (fdatasync(dp->fd) != 0)
+		return errno;
+
+	dp->job_us = mono_us() - start;
+	return 0;
+}
+
+static void add_probe(struct diskprobe *dp, long us)
+{
+	dp->hist[hist_bucket((us > 0x7fffffffL) ? 0x7fffffff : (unsigned int)us)]++;
+
+	if (++dp->nprobes % PROBE_DECAY == 0) {
+		int ii;
+		for (ii = 0; ii < HIST_BUCKETS; ii++)
+			dp->hist[ii] /= 2;
+	}
+}
+
+int check_diskprobe(struct list *act)
+{
+	struct diskprobe *dp = act->parameter.disk.probe;
+	unsigned int p99;
+	time_t now;
+	int err;
+
+	if (dp == NULL)
+		return (ENOERR);
+
+	now = mono_seconds();
+	if (now < dp->next)
+		return (ENOERR);
+	dp->next = now + disk_probe_interval;
+
+	if (dp->late) {
+		if ((err = finish_deadline(dp->dl)) == ETIMEDOUT) {
+			log_message(LOG_ERR, "write to %s has still not completed", act->name);
+			return (ETIMEDOUT);
+		}
+		dp->late = FALSE;
+		if (err != ENOERR) {
+			log_message(LOG_ERR, "write to %s gave errno = %d = '%s'", act->name, err, strerror(err));
+			return (err);
+		}
+		if (dp->job_us >= 0) {
+			log_message(LOG_WARNING, "write to %s completed after %ld ms", act->name, dp->job_us / 1000);
+			add_probe(dp, dp->job_us);
+		}
+	}
+
+	dp->job_us = -1;
+	err = run_deadline(dp->dl, probe_job, dp, 1000L * disk_probe_timeout);
+
+	if (err == ETIMEDOUT) {
+		log_message(LOG_ERR, "write to %s did not complete within %d seconds", act->name, disk_probe_timeout);
+		dp->late = TRUE;
+		return (ETIMEDOUT);
+	}
+
+	/* The helper has finished, so its results can be looked at. */
+	if (dp->direct_failed) {
+		log_message(LOG_WARNING, "O_DIRECT not supported for disk probe %s", act->name);
+		dp->direct_failed = FALSE;
+	}
+
+	if (err != ENOERR) {
+		log_message(LOG_ERR, "write to %s gave errno = %d = '%s'", act->name, err, strerror(err));
+		return (err);
+	}
+
+	add_probe(dp, dp->job_us);
+	p99 = hist_percentile(dp->hist, 99);
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "write to %s took %ld us (99th percentile %u us)%s",
+			act->name, dp->job_us, p99, dp->direct ? " with O_DIRECT" : "");
+
+	if (max_disk_latency > 0 && dp->job_us > 1000L * max_disk_latency) {
+		log_message(LOG_ERR, "write to %s took %ld ms, more than %d ms", act->name, dp->job_us / 1000, max_disk_latency);
+		return (EIOSLOW);
+	}
+
+	if (max_disk_latency_p99 > 0 && p99 > 1000U * max_disk_latency_p99) {
+		log_message(LOG_ERR, "99th percentile write time to %s is %u ms, more than %d ms",
+			act->name, p99 / 1000, max_disk_latency_p99);
+		return (EIOSLOW);
+	}
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_diskprobe(void)
+{
+	struct list *act;
+
+	for (act = disk_list; act != NULL; act = act->next) {
+		struct diskprobe *dp = act->parameter.disk.probe;
+
+		if (dp == NULL)
+			continue;
+
+		/* If the helper is stuck it still uses the probe, so leave it. */
+		if (close_deadline(dp->dl) == 0) {
+			if (dp->fd != -1)
+				close(dp->fd);
+			free(dp->buf);
+			free(dp);
+		}
+
+		act->parameter.disk.probe = NULL;
+	}
+
+	return 0;
+}
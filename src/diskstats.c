@@ -0,0 +1,286 @@
+/* > diskstats.c
+ *
+ * Code for spotting stuck or very slow block devices from the kernel's own
+ * I/O counters in /proc/diskstats, without doing any I/O ourselves.
+ *
+ * Once per interval the file is read with a single pread() and the change in
+ * each device's counters since the last interval gives:
+ *
+ *  - await, the average time each completed request took;
+ *  - utilisation, the share of the interval the device was busy;
+ *  - queue depth, the average number of requests in progress.
+ *
+ * A device that has requests in flight but completes none of them is stalled.
+ * How long that has gone on for is tracked, and a stall longer than
+ * 'disk-stall-time' (or an await above 'max-disk-await') is reported as EIOSLOW.
+ * The in-flight count is the same one as /sys/block/<dev>/inflight gives.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+/* Fields of a /proc/diskstats line after major, minor & name (from 0). */
+enum {
+	DS_READS = 0, DS_READS_MERGED, DS_SECT_READ, DS_MS_READ,
+	DS_WRITES, DS_WRITES_MERGED, DS_SECT_WRITTEN, DS_MS_WRITE,
+	DS_IN_FLIGHT, DS_MS_IO, DS_MS_WEIGHTED,
+	DS_DISCARDS, DS_DISCARDS_MERGED, DS_SECT_DISCARD, DS_MS_DISCARD,
+	DS_FLUSHES, DS_MS_FLUSH,
+	DS_NUM
+};
+
+struct devstat {
+	char name[32];
+	int seen;					/* found in the last reading */
+	int skip;					/* not one we look at, see wanted() */
+	unsigned long long val[DS_NUM];
+	time_t stall_since;			/* monotonic time, 0 if not stalled */
+};
+
+static const char ds_name[] = "/proc/diskstats";
+static int ds_fd = -1;
+static char *ds_buf = NULL;
+static size_t ds_size = 0;
+static struct devstat *devs = NULL;
+static int ndevs = 0;
+static long long last_ms = 0;
+
+/* ============================================================================ */
+
+int open_diskstats(void)
+{
+	close_diskstats();
+
+	if (disk_stall_time <= 0 && max_disk_await <= 0)
+		return -1;
+
+	ds_fd = open(ds_name, O_RDONLY | O_CLOEXEC);
+	if (ds_fd == -1) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", ds_name, errno, strerror(errno));
+		return -1;
+	}
+
+	ds_size = 8192;
+	ds_buf = xmalloc(ds_size);
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Is this a device we should look at? Only asked when a device is first seen.
+ * By default partitions are left out, as they stall along with their disk.
+ */
+
+static int wanted(const char *name)
+{
+	struct list *act;
+
+	if (diskstats_list == NULL) {
+		char path[PATH_MAX];
+
+		if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0 || strncmp(name, "zram", 4) == 0)
+			return FALSE;
+
+		snprintf(path, sizeof(path), "/sys/class/block/%s/partition", name);
+		return access(path, F_OK) != 0;
+	}
+
+	for (act = diskstats_list; act != NULL; act = act->next) {
+		if (strcmp(act->name, name) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Find a device's entry, trying the same position as last time first as the
+ * order of /proc/diskstats rarely changes.
+ */
+
+static struct devstat *find_dev(const char *name, int hint)
+{
+	int ii;
+
+	if (hint < ndevs && strcmp(devs[hint].name, name) == 0)
+		return &devs[hint];
+
+	for (ii = 0; ii < ndevs; ii++) {
+		if (strcmp(devs[ii].name, name) == 0)
+			return &devs[ii];
+	}
+
+	return NULL;
+}
+
+static int read_diskstats(void)
+{
+	int n;
+
+	while ((n = pread(ds_fd, ds_buf, ds_size - 1, 0)) >= (int)ds_size - 1) {
+		char *bigger = realloc(ds_buf, 2 * ds_size);
+		if (bigger == NULL) {
+			log_message(LOG_ERR, "cannot grow %s buffer to %lu bytes", ds_name, (unsigned long)(2 * ds_size));
+			return (ENOMEM);
+		}
+		ds_buf = bigger;
+		ds_size *= 2;
+	}
+
+	if (n < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", ds_name, err, strerror(err));
+		return (err);
+	}
+
+	ds_buf[n] = 0;
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int check_diskstats(void)
+{
+	long long now_ms, elapsed;
+	time_t now;
+	char *line, *next;
+	int err = ENOERR, idx = 0, ii;
+
+	if (ds_fd == -1)
+		return (ENOERR);
+
+	if ((err = read_diskstats()) != ENOERR)
+		return (err);
+
+	now_ms = mono_ms();
+	now = now_ms / 1000;
+	elapsed = now_ms - last_ms;
+	last_ms = now_ms;
+
+	for (ii = 0; ii < ndevs; ii++)
+		devs[ii].seen = FALSE;
+
+	for (line = ds_buf; line != NULL && *line; line = next) {
+		unsigned long long val[DS_NUM], done, ms;
+		char name[32], *ptr;
+		struct devstat *dev;
+		int first;
+
+		next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = 0;
+
+		/* "   8       0 sda 1234 ..." */
+		strtoul(line, &ptr, 10);
+		strtoul(ptr, &ptr, 10);
+		while (*ptr == ' ')
+			ptr++;
+		for (ii = 0; *ptr && *ptr != ' ' && ii < (int)sizeof(name) - 1; ii++)
+			name[ii] = *ptr++;
+		name[ii] = 0;
+
+		if (ii == 0)
+			continue;
+
+		first = FALSE;
+		dev = find_dev(name, idx++);
+		if (dev == NULL) {
+			struct devstat *bigger = realloc(devs, (ndevs + 1) * sizeof(struct devstat));
+			if (bigger == NULL)
+				return (ENOMEM);
+			devs = bigger;
+			dev = &devs[ndevs++];
+			memset(dev, 0, sizeof(*dev));
+			strcpy(dev->name, name);
+			dev->skip = !wanted(name);
+			first = TRUE;
+		}
+		dev->seen = TRUE;
+
+		if (dev->skip)
+			continue;
+
+		/* Older kernels have fewer fields, those missing stay 0. */
+		memset(val, 0, sizeof(val));
+		for (ii = 0; ii < DS_NUM && *ptr; ii++)
+			val[ii] = strtoull(ptr, &ptr, 10);
+
+		if (first || elapsed <= 0) {
+			memcpy(dev->val, val, sizeof(val));
+			continue;
+		}
+
+#define DELTA(f)	((val[f] > dev->val[f]) ? val[f] - dev->val[f] : 0ULL)
+		done = DELTA(DS_READS) + DELTA(DS_WRITES) + DELTA(DS_DISCARDS) + DELTA(DS_FLUSHES);
+		ms = DELTA(DS_MS_READ) + DELTA(DS_MS_WRITE) + DELTA(DS_MS_DISCARD) + DELTA(DS_MS_FLUSH);
+
+		/* Requests waiting but none finished? */
+		if (val[DS_IN_FLIGHT] > 0 && done == 0) {
+			if (dev->stall_since == 0)
+				dev->stall_since = now;
+		} else {
+			dev->stall_since = 0;
+		}
+
+		if (verbose && logtick && ticker == 1)
+			log_message(LOG_DEBUG, "%s: await %llu ms, %llu%% busy, queue %llu.%02llu, %llu in flight",
+				name, done ? ms / done : 0ULL, 100 * DELTA(DS_MS_IO) / elapsed,
+				DELTA(DS_MS_WEIGHTED) / elapsed, (100 * DELTA(DS_MS_WEIGHTED) / elapsed) % 100,
+				val[DS_IN_FLIGHT]);
+
+		if (disk_stall_time > 0 && dev->stall_since != 0 && now - dev->stall_since >= disk_stall_time) {
+			log_message(LOG_ERR, "%s has had %llu request(s) in flight with none completed for %ld seconds",
+				name, val[DS_IN_FLIGHT], (long)(now - dev->stall_since));
+			err = EIOSLOW;
+		} else if (max_disk_await > 0 && done > 0 && ms / done > (unsigned long long)max_disk_await) {
+			log_message(LOG_ERR, "%s average request time %llu ms is more than %d ms",
+				name, ms / done, max_disk_await);
+			err = EIOSLOW;
+		}
+#undef DELTA
+
+		memcpy(dev->val, val, sizeof(val));
+	}
+
+	/* Forget devices that have gone. */
+	for (ii = 0; ii < ndevs; ) {
+		if (!devs[ii].seen)
+			devs[ii] = devs[--ndevs];
+		else
+			ii++;
+	}
+
+	return (err);
+}
+
+/* ============================================================================ */
+
+int close_diskstats(void)
+{
+	if (ds_fd != -1)
+		close(ds_fd);
+
+	free(ds_buf);
+	free(devs);
+	ds_fd = -1;
+	ds_buf = NULL;
+	ds_size = 0;
+	devs = NULL;
+	ndevs = 0;
+	last_ms = 0;
+	return 0;
+}
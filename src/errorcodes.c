@@ -35,6 +35,17 @@ const char *wd_strerror(int err)
 		case ETOOLONG:		str = "child process did not return in time"; break;
 		case EUSERVALUE:	str = "user-reserved code"; break;
 		case EDONTKNOW:		str = "unknown (neither good nor bad)"; break;
+		case ECPUTIME:		str = "CPU steal/iowait/interrupt time too high"; break;
+		case ELATENCY:		str = "scheduling latency too high"; break;
+		case ETEMPRISE:		str = "temperature rising towards limit"; break;
+		case ENOPROGRESS:	str = "process stuck or making no progress"; break;
+		case EHUNGTASK:		str = "tasks hung in uninterruptible sleep"; break;
+		case EIOSLOW:		str = "disk write latency too high"; break;
+		case EKMSG:			str = "kernel log message seen"; break;
+		case EHWERR:		str = "hardware errors (EDAC/AER) too high"; break;
+		case EDEGRADED:		str = "RAID array degraded or failed"; break;
+		case ETIMEJUMP:		str = "system clock stepped"; break;
+		case EPRESSURE:		str = "sustained memory pressure"; break;
 		default:			str = strerror(err); break;
 	}
 
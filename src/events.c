@@ -0,0 +1,190 @@
+/* > events.c
+ *
+ * Code for waiting on file descriptors in the main loop. Rather than simply
+ * sleeping between one round of checks and the next, the daemon waits in ppoll()
+ * on any descriptors the checks have asked for, so a fault that the kernel can
+ * tell us about (for example a sysfs attribute that gets notified) is acted on
+ * within milliseconds instead of at the next interval.
+ *
+ * Each check registers its descriptor with a handler function that is called
+ * when the descriptor is ready. The handler returns an error code just as a
+ * normal check_*() function does, and that is passed on to the same error and
+ * repair handling as the periodic checks.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE		/* For ppoll() */
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+struct event_src {
+	event_func func;
+	void *arg;
+	struct list *act;
+};
+
+static struct pollfd *pfds = NULL;
+static struct event_src *srcs = NULL;
+static int nfds = 0;
+static int maxfds = 0;
+static int poll_failed = FALSE;		/* error logged, don't repeat it */
+static void (*event_action)(int result, struct list *act) = NULL;
+
+/* ============================================================================ */
+
+/*
+ * Add a descriptor to the set waited on. The 'act' is the configuration entry
+ * the error is reported against (it may be NULL) for the retry/repair handling.
+ */
+
+int add_event_fd(int fd, short events, event_func func, void *arg, struct list *act)
+{
+	if (fd < 0 || func == NULL)
+		return -1;
+
+	if (nfds == maxfds) {
+		struct pollfd *p;
+		struct event_src *s;
+		int newmax = (maxfds == 0) ? 16 : 2 * maxfds;
+
+		p = realloc(pfds, newmax * sizeof(struct pollfd));
+		if (p == NULL)
+			return -1;
+		pfds = p;
+
+		s = realloc(srcs, newmax * sizeof(struct event_src));
+		if (s == NULL)
+			return -1;
+		srcs = s;
+
+		maxfds = newmax;
+	}
+
+	pfds[nfds].fd = fd;
+	pfds[nfds].events = events;
+	pfds[nfds].revents = 0;
+	srcs[nfds].func = func;
+	srcs[nfds].arg = arg;
+	srcs[nfds].act = act;
+	nfds++;
+
+	return 0;
+}
+
+/*
+ * Remove a descriptor from the set. This must be called before the descriptor
+ * is closed.
+ */
+
+void remove_event_fd(int fd)
+{
+	int ii;
+
+	for (ii = 0; ii < nfds; ii++) {
+		if (pfds[ii].fd == fd) {
+			nfds--;
+			pfds[ii] = pfds[nfds];
+			srcs[ii] = srcs[nfds];
+			return;
+		}
+	}
+}
+
+/*
+ * For a handler whose descriptor serves several configuration entries, report
+ * a result against one of them rather than the descriptor's own entry.
+ */
+
+void report_event(int result, struct list *act)
+{
+	if (event_action != NULL)
+		event_action(result, act);
+}
+
+/* ============================================================================ */
+
+/*
+ * Wait for 'usec' microseconds, calling the handler for each descriptor that
+ * becomes ready and passing its result to 'action' as it happens.
+ */
+
+void wait_for_events(unsigned long usec, void (*action)(int result, struct list *act))
+{
+	struct timespec now, end;
+
+	event_action = action;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec  += usec / 1000000;
+	end.tv_nsec += (usec % 1000000) * 1000;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_nsec -= 1000000000L;
+		end.tv_sec++;
+	}
+
+	while (_running) {
+		struct timespec left;
+		int ii, n;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left.tv_sec  = end.tv_sec - now.tv_sec;
+		left.tv_nsec = end.tv_nsec - now.tv_nsec;
+		if (left.tv_nsec < 0) {
+			left.tv_nsec += 1000000000L;
+			left.tv_sec--;
+		}
+		if (left.tv_sec < 0)
+			break;
+
+		n = ppoll(pfds, nfds, &left, NULL);
+		if (n < 0) {
+			if (errno != EINTR) {
+				if (!poll_failed)
+					log_message(LOG_ERR, "ppoll gave errno = %d = '%s'", errno, strerror(errno));
+				poll_failed = TRUE;
+				/* Just sleep for what is left of the interval, events wait until next time. */
+				nanosleep(&left, NULL);
+				break;
+			}
+			continue;
+		}
+		poll_failed = FALSE;
+
+		if (n == 0)
+			break;
+
+		/* Note a handler may remove its own descriptor, so work downwards. */
+		for (ii = nfds - 1; ii >= 0; ii--) {
+			if (ii < nfds && pfds[ii].revents) {
+				struct event_src src = srcs[ii];
+				int fd = pfds[ii].fd;
+				short revents = pfds[ii].revents;
+
+				pfds[ii].revents = 0;
+				action(src.func(fd, revents, src.arg), src.act);
+			}
+		}
+	}
+}
+
+/* ============================================================================ */
+
+void close_events(void)
+{
+	free(pfds);
+	free(srcs);
+	pfds = NULL;
+	srcs = NULL;
+	nfds = maxfds = 0;
+}
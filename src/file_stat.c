@@ -2,39 +2,294 @@
 #include "config.h"
 #endif
 
+#define _GNU_SOURCE		/* For statx() */
+
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
+#include <string.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
 
 #include "extern.h"
 #include "watch_err.h"
 
-int check_file_stat(struct list *file)
+/*
+ * File systems that don't (reliably) report changes made by other machines
+ * through inotify. Files on these are checked with stat() as before.
+ */
+static const long remote_fs[] = {
+	0x6969,			/* NFS */
+	0x517B,			/* SMB */
+	0xFF534D42,		/* CIFS */
+	0xFE534D42,		/* SMB2 */
+	0x65735546,		/* FUSE */
+	0x01021997,		/* 9P */
+	0x00C36400,		/* Ceph */
+	0x47504653,		/* GPFS */
+	0x0BD00BD0,		/* Lustre */
+	0
+};
+
+static int is_remote(const char *name)
+{
+	struct statfs sfs;
+	int ii;
+
+	if (statfs(name, &sfs) != 0) {
+		/* The file may not exist yet, so try its directory. */
+		char dir[PATH_MAX], *slash;
+
+		strncpy(dir, name, sizeof(dir) - 1);
+		dir[sizeof(dir) - 1] = 0;
+		if ((slash = strrchr(dir, '/')) == NULL)
+			return TRUE;
+		if (slash == dir)
+			slash[1] = 0;	/* keep the root directory */
+		else
+			*slash = 0;
+		if (statfs(dir, &sfs) != 0)
+			return TRUE;	/* can't tell, so play safe */
+	}
+
+	for (ii = 0; remote_fs[ii] != 0; ii++) {
+		if ((unsigned int)sfs.f_type == (unsigned int)remote_fs[ii])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Called by fwatch.c when a file changes. A write is taken as the file being
+ * changed now, anything else (a new file, or a time-stamp being set) needs a
+ * stat() to get the real modification time.
+ */
+
+static void file_changed(void *arg, unsigned int mask)
+{
+	struct filemode *fm = &((struct list *)arg)->parameter.file;
+
+	if (mask & IN_MODIFY)
+		fm->changed = mono_seconds();
+
+	if (mask & (IN_ATTRIB | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_Q_OVERFLOW))
+		fm->need_stat = TRUE;
+}
+
+/* Called in the helper thread. */
+static int remote_job(void *arg)
+{
+	struct list *file = arg;
+
+	return is_remote(file->name) ? EREMOTE : ENOERR;
+}
+
+/*
+ * Files on local file systems are watched with inotify so they don't need to
+ * be looked at every interval. Those on network file systems are still checked
+ * with stat(), as that also tests the server is answering.
+ *
+ * The statfs() to tell which is which can hang on a dead server too, so it is
+ * made from the file's helper with the same time limit as stat(). A file that
+ * can't be classified in time is taken to be on a network file system.
+ */
+
+int open_filecheck(struct list *flist)
+{
+	struct list *act;
+
+	for (act = flist; act != NULL; act = act->next) {
+		struct filemode *fm = &act->parameter.file;
+		int remote;
+
+		/* stat() on a network file system can hang, so do it from a helper. */
+		fm->dl = NULL;
+		if (stat_timeout > 0 && (fm->dl = open_deadline()) != NULL) {
+			int err = run_deadline(fm->dl, remote_job, act, 1000L * stat_timeout);
+
+			if (err == ETIMEDOUT)
+				log_message(LOG_WARNING, "statfs of %s did not complete within %d seconds", act->name, stat_timeout);
+			remote = (err != ENOERR);
+			if (!remote) {
+				close_deadline(fm->dl);
+				fm->dl = NULL;
+			}
+		} else {
+			remote = is_remote(act->name);
+		}
+
+		fm->need_stat = TRUE;
+		fm->watched = FALSE;
+		if (!remote)
+			fm->watched = (add_file_watch(act->name, file_changed, act) == 0);
+
+		if (verbose)
+			log_message(LOG_DEBUG, "file %s is %s", act->name,
+				fm->watched ? "watched with inotify" :
+				fm->dl ? "checked with stat() with a time-out" : "checked with stat()");
+	}
+
+	return 0;
+}
+
+int close_filecheck(void)
+{
+	struct list *act;
+
+	for (act = file_list; act != NULL; act = act->next) {
+		close_deadline(act->parameter.file.dl);
+		act->parameter.file.dl = NULL;
+	}
+
+	return 0;
+}
+
+/*
+ * Called by timejump.c when the clock has been stepped. Modification times from
+ * before the step no longer match the clock, so each file is treated as changed
+ * now, and the stat() that follows only notes the current modification time so
+ * it is ignored until the file changes again.
+ */
+
+void rebase_filecheck(void)
+{
+	struct list *act;
+	time_t now = mono_seconds();
+
+	for (act = file_list; act != NULL; act = act->next) {
+		struct filemode *fm = &act->parameter.file;
+
+		fm->changed = now;
+		fm->rebase = TRUE;
+		fm->need_stat = TRUE;
+	}
+}
+
+/* ============================================================================ */
+
+/*
+ * Get the modification time of a file. With statx() we ask for only that, and
+ * can say whether a network file system may use its cached attributes.
+ */
+
+static int get_mtime(const char *name, time_t *mtime)
 {
 	struct stat buf;
 
-	if (file == NULL) {
+#ifdef HAVE_STATX
+	struct statx stx;
+	int flags = stat_dont_sync ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT;
+
+	if (statx(AT_FDCWD, name, flags, STATX_MTIME, &stx) == 0) {
+		*mtime = stx.stx_mtime.tv_sec;
 		return (ENOERR);
 	}
 
+	if (errno != ENOSYS)
+		return (errno);
+#endif
+
+	if (stat(name, &buf) == -1)
+		return (errno);
+
+	*mtime = buf.st_mtime;
+	return (ENOERR);
+}
+
+/* Called in the helper thread. */
+static int stat_job(void *arg)
+{
+	struct list *file = arg;
+
+	return get_mtime(file->name, &file->parameter.file.job_mtime);
+}
+
+static int stat_file(struct list *file, time_t now)
+{
+	struct filemode *fm = &file->parameter.file;
+	time_t mtime;
+	int err;
+
 	/* in filemode stat file */
-	if (stat(file->name, &buf) == -1) {
-		int err = errno;
+	if (fm->dl != NULL) {
+		/* The helper may still be writing job_mtime unless it has finished. */
+		if ((err = run_deadline(fm->dl, stat_job, file, 1000L * stat_timeout)) == ENOERR)
+			mtime = fm->job_mtime;
+	} else {
+		err = get_mtime(file->name, &mtime);
+	}
+
+	if (err == ETIMEDOUT && fm->dl != NULL) {
+		log_message(LOG_ERR, "stat of %s did not complete within %d seconds", file->name, stat_timeout);
+		fm->need_stat = TRUE;
+		return (err);
+	} else if (err != ENOERR) {
 		log_message(LOG_ERR, "cannot stat %s (errno = %d = '%s')", file->name, err, strerror(err));
+		fm->need_stat = TRUE;
 		return (err);
-	} else if (file->parameter.file.mtime != 0) {
-		int twait = (int)(time(NULL) - buf.st_mtime);
+	}
+
+	/* Convert the modification time to the monotonic clock, unless it is from before a clock step. */
+	if (fm->rebase) {
+		fm->rebase = FALSE;
+		fm->rebase_mtime = mtime;
+	} else if (fm->rebase_mtime == 0 || mtime != fm->rebase_mtime) {
+		fm->changed = now - (time(NULL) - mtime);
+		fm->rebase_mtime = 0;
+	}
+	fm->need_stat = FALSE;
+
+	if (fm->watched) {
+		/* Just in case an event was missed. */
+		fm->next_stat = now + file_stat_interval;
+	} else if (fm->mtime != 0) {
+		/* No need to look again until it would be too old. */
+		fm->next_stat = fm->changed + fm->mtime + 1;
+		if (fm->next_stat > now + file_stat_interval)
+			fm->next_stat = now + file_stat_interval;
+	} else {
+		fm->next_stat = now;
+	}
+
+	return (ENOERR);
+}
+
+int check_file_stat(struct list *file)
+{
+	struct filemode *fm;
+	time_t now;
+
+	if (file == NULL) {
+		return (ENOERR);
+	}
+
+	fm = &file->parameter.file;
+	now = mono_seconds();
+
+	if (fm->need_stat || now >= fm->next_stat || (fm->mtime != 0 && now - fm->changed > fm->mtime)) {
+		/* Always confirm with stat() before reporting a file as unchanged. */
+		int err = stat_file(file, now);
+		if (err != ENOERR)
+			return (err);
+	}
+
+	if (fm->mtime != 0) {
+		int twait = (int)(now - fm->changed);
 
-		if (twait > file->parameter.file.mtime) {
+		if (twait > fm->mtime) {
 			/* file wasn't changed often enough */
-			log_message(LOG_ERR, "file %s was not changed in %d seconds (more than %d)", file->name, twait, file->parameter.file.mtime);
+			log_message(LOG_ERR, "file %s was not changed in %d seconds (more than %d)", file->name, twait, fm->mtime);
 			return (ENOCHANGE);
 		}
 		/* do verbose logging */
 		if (verbose && logtick && ticker == 1) {
 			char text[25];
+			time_t mtime = time(NULL) - twait;
 			/* Remove the trailing '\n' of the ctime() formatted string. */
-			strncpy(text, ctime(&buf.st_mtime), sizeof(text)-1);
+			strncpy(text, ctime(&mtime), sizeof(text)-1);
 			text[sizeof(text)-1] = 0;
 			log_message(LOG_DEBUG, "file %s was last changed at %s (%ds ago)", file->name, text, twait);
 		}
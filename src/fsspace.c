@@ -0,0 +1,150 @@
+/* > fsspace.c
+ *
+ * Code for checking that file systems, such as the root or the one holding the
+ * logs, are not close to running out of space or inodes. A full file system
+ * leaves many services wedged rather than stopped.
+ *
+ * Each 'fs-space' entry is "path:min-free-%:min-inodes-%", the last part being
+ * optional. The path is opened once at start-up and fstatfs() used on that, so
+ * the path is not looked up again and nothing is allocated for the check.
+ *
+ * Free space is what is available to normal users, so the blocks kept for root
+ * count as used. Inodes are not checked on file systems that don't have a fixed
+ * number of them (such as btrfs), as they report a total of 0.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/vfs.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+/* ============================================================================ */
+
+/*
+ * Take the ":percent" off the end of 'name', returning the value or -1 if there
+ * isn't one.
+ */
+
+static int strip_percent(char *name)
+{
+	char *colon = strrchr(name, ':'), *end;
+	long val;
+
+	if (colon == NULL)
+		return -1;
+
+	val = strtol(colon + 1, &end, 10);
+	if (end == colon + 1 || (*end != 0 && strcmp(end, "%") != 0) || val < 0 || val > 100)
+		return -1;
+
+	*colon = 0;
+	return (int)val;
+}
+
+int open_fscheck(struct list *flist)
+{
+	struct list *act;
+
+	for (act = flist; act != NULL; act = act->next) {
+		struct fsmode *fs = &act->parameter.fs;
+		int first, second;
+
+		fs->fd = -1;
+
+		/* "path:free" or "path:free:inodes" */
+		second = strip_percent(act->name);
+		first = strip_percent(act->name);
+		if (first >= 0) {
+			fs->min_free = first;
+			fs->min_inodes = second;
+		} else {
+			fs->min_free = second;
+			fs->min_inodes = -1;
+		}
+
+		if (fs->min_free < 0) {
+			log_message(LOG_ERR, "fs-space %s has no minimum free percentage, not checked", act->name);
+			continue;
+		}
+
+		fs->fd = open(act->name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+		if (fs->fd == -1) {
+			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", act->name, errno, strerror(errno));
+			continue;
+		}
+
+		if (verbose)
+			log_message(LOG_DEBUG, "file system %s needs %d%% space and %d%% inodes free",
+				act->name, fs->min_free, (fs->min_inodes < 0) ? 0 : fs->min_inodes);
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+int check_fsspace(struct list *act)
+{
+	struct fsmode *fs = &act->parameter.fs;
+	unsigned long long free_pc, inodes_pc = 100;
+	struct statfs sfs;
+
+	if (fs->fd == -1)
+		return (ENOERR);
+
+	if (fstatfs(fs->fd, &sfs) != 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot statfs %s (errno = %d = '%s')", act->name, err, strerror(err));
+		return (err);
+	}
+
+	if (sfs.f_blocks == 0)
+		return (ENOERR);
+
+	free_pc = 100ULL * sfs.f_bavail / sfs.f_blocks;
+	if (sfs.f_files > 0)
+		inodes_pc = 100ULL * sfs.f_ffree / sfs.f_files;
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "file system %s has %llu%% space and %llu%% inodes free",
+			act->name, free_pc, inodes_pc);
+
+	if (free_pc < (unsigned long long)fs->min_free) {
+		log_message(LOG_ERR, "file system %s has %llu%% space free (less than %d%%)",
+			act->name, free_pc, fs->min_free);
+		return (ENOSPC);
+	}
+
+	if (fs->min_inodes > 0 && sfs.f_files > 0 && inodes_pc < (unsigned long long)fs->min_inodes) {
+		log_message(LOG_ERR, "file system %s has %llu%% inodes free (less than %d%%)",
+			act->name, inodes_pc, fs->min_inodes);
+		return (ENOSPC);
+	}
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_fscheck(void)
+{
+	struct list *act;
+
+	for (act = fs_list; act != NULL; act = act->next) {
+		if (act->parameter.fs.fd != -1)
+			close(act->parameter.fs.fd);
+		act->parameter.fs.fd = -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+/* > fwatch.c
+ *
+ * Code for getting told by inotify when a monitored file changes, rather than
+ * having to look at it every interval. Each file gets two watches: one on the
+ * file itself for it being written to, and one on its directory for it being
+ * created, deleted, or replaced by rename() as many programs do when updating a
+ * PID file, for example.
+ *
+ * A single inotify descriptor is used for all files and it is waited on in the
+ * main loop's ppoll() (see events.c). When something happens to a file the
+ * function given for it is called with the inotify event mask. If the kernel
+ * event queue overflows then every function is called with IN_Q_OVERFLOW so
+ * it knows it has to check its file the hard way.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define FILE_EVENTS	(IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB)
+#define DIR_EVENTS	(IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+struct fwatch {
+	char *dir;
+	const char *name;			/* points in to 'dir' storage */
+	int dir_wd;
+	int file_wd;
+	fwatch_func func;
+	void *arg;
+};
+
+static int ino_fd = -1;
+static struct fwatch *watches = NULL;
+static int nwatches = 0;
+
+static int fwatch_event(int fd, short revents, void *arg);
+
+/* ============================================================================ */
+
+/*
+ * Start watching 'path', calling func(arg, mask) when it changes. Returns 0 on
+ * success or -1 if the file can't be watched, in which case the caller should
+ * carry on checking it every interval.
+ */
+
+int add_file_watch(const char *path, fwatch_func func, void *arg)
+{
+	struct fwatch *w;
+	char *slash;
+
+	if (ino_fd == -1) {
+		ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (ino_fd == -1) {
+			log_message(LOG_ERR, "cannot initialise inotify (errno = %d = '%s')", errno, strerror(errno));
+			return -1;
+		}
+		if (add_event_fd(ino_fd, POLLIN, fwatch_event, NULL, NULL) != 0) {
+			close(ino_fd);
+			ino_fd = -1;
+			return -1;
+		}
+	}
+
+	w = realloc(watches, (nwatches + 1) * sizeof(struct fwatch));
+	if (w == NULL)
+		return -1;
+	watches = w;
+	w = &watches[nwatches];
+
+	/* Store as "dir\0name" so both parts are available (one spare byte for "/\0name"). */
+	w->dir = xmalloc(strlen(path) + 2);
+	strcpy(w->dir, path);
+	slash = strrchr(w->dir, '/');
+	if (slash == NULL || slash[1] == 0) {
+		log_message(LOG_ERR, "cannot watch %s, full path name required", path);
+		free(w->dir);
+		return -1;
+	}
+
+	w->name = slash + 1;
+	if (slash == w->dir) {
+		/* File in the root directory, keep the "/" */
+		memmove(w->dir + 2, w->dir + 1, strlen(w->dir + 1) + 1);
+		w->dir[1] = 0;
+		w->name = w->dir + 2;
+	} else {
+		*slash = 0;
+	}
+
+	w->dir_wd = inotify_add_watch(ino_fd, w->dir, DIR_EVENTS | IN_ONLYDIR);
+	if (w->dir_wd == -1) {
+		log_message(LOG_ERR, "cannot watch directory %s (errno = %d = '%s')", w->dir, errno, strerror(errno));
+		free(w->dir);
+		return -1;
+	}
+
+	/* The file might not exist yet, that is OK as the directory watch will tell us. */
+	w->file_wd = inotify_add_watch(ino_fd, path, FILE_EVENTS);
+	w->func = func;
+	w->arg = arg;
+	nwatches++;
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Read and dispatch all pending inotify events. Nothing is reported directly, it
+ * is up to the functions called to note the change for the next check.
+ */
+
+static int fwatch_event(int fd, short revents GCC_UNUSED, void *arg GCC_UNUSED)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *ptr;
+	int ii;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)ptr;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				log_message(LOG_WARNING, "inotify queue overflow, re-checking all files");
+				for (ii = 0; ii < nwatches; ii++)
+					watches[ii].func(watches[ii].arg, IN_Q_OVERFLOW);
+				continue;
+			}
+
+			for (ii = 0; ii < nwatches; ii++) {
+				struct fwatch *w = &watches[ii];
+
+				if (ev->wd == w->file_wd) {
+					if (ev->mask & IN_IGNORED) {
+						/* File has gone, the directory watch will see any new one. */
+						w->file_wd = -1;
+					} else {
+						w->func(w->arg, ev->mask);
+					}
+				} else if (ev->wd == w->dir_wd && ev->len > 0 && strcmp(ev->name, w->name) == 0) {
+					if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+						char path[PATH_MAX];
+						snprintf(path, sizeof(path), "%s/%s", strcmp(w->dir, "/") ? w->dir : "", w->name);
+						if (w->file_wd != -1)
+							inotify_rm_watch(ino_fd, w->file_wd);
+						w->file_wd = inotify_add_watch(ino_fd, path, FILE_EVENTS);
+					}
+					w->func(w->arg, ev->mask);
+				}
+			}
+		}
+	}
+
+	if (len < 0 && errno != EAGAIN) {
+		int err = errno;
+		log_message(LOG_ERR, "read of inotify events gave errno = %d = '%s'", err, strerror(err));
+		return (err);
+	}
+
+	return (EDONTKNOW);
+}
+
+/* ============================================================================ */
+
+void close_file_watches(void)
+{
+	int ii;
+
+	if (ino_fd != -1) {
+		remove_event_fd(ino_fd);
+		close(ino_fd);
+	}
+
+	for (ii = 0; ii < nwatches; ii++)
+		free(watches[ii].dir);
+
+	free(watches);
+	watches = NULL;
+	nwatches = 0;
+	ino_fd = -1;
+}
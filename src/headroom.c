@@ -0,0 +1,254 @@
+/* > headroom.c
+ *
+ * Code for warning that the kernel's file table or process table is getting
+ * full, before open() fails with ENFILE or fork() with EAGAIN. By then it is
+ * often too late for a repair binary to run at all.
+ *
+ * The number of files in use comes from /proc/sys/fs/file-nr, which also gives
+ * the file-max limit. The number of tasks (threads, as each one uses a PID) is
+ * the total from /proc/loadavg, compared with the lower of pid_max and
+ * threads-max. Note that sysinfo() can't be used for this as its process count
+ * is only 16 bits. Zombies are counted by the /proc scan in procscan.c, and as
+ * they hold on to their PID they are compared with pid_max.
+ *
+ * For network tables, the connection tracking count is compared with
+ * nf_conntrack_max, as a full table drops new connections long before a ping
+ * would fail. From /proc/net/sockstat the TCP orphans, sockets in TIME-WAIT and
+ * memory used are compared with tcp_max_orphans, tcp_max_tw_buckets and the
+ * highest tcp_mem value, past any of which the kernel starts dropping sockets.
+ *
+ * All files are kept open and read with pread(), and the limits are read each
+ * time as they can be changed with sysctl.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+static const char filenr_name[] = "/proc/sys/fs/file-nr";
+static const char loadavg_name[] = "/proc/loadavg";
+static const char pidmax_name[] = "/proc/sys/kernel/pid_max";
+static const char threadsmax_name[] = "/proc/sys/kernel/threads-max";
+static const char ctcount_name[] = "/proc/sys/net/netfilter/nf_conntrack_count";
+static const char ctmax_name[] = "/proc/sys/net/netfilter/nf_conntrack_max";
+static const char sockstat_name[] = "/proc/net/sockstat";
+static const char orphans_name[] = "/proc/sys/net/ipv4/tcp_max_orphans";
+static const char twmax_name[] = "/proc/sys/net/ipv4/tcp_max_tw_buckets";
+static const char tcpmem_name[] = "/proc/sys/net/ipv4/tcp_mem";
+
+static int filenr_fd = -1;
+static int loadavg_fd = -1;
+static int pidmax_fd = -1;
+static int threadsmax_fd = -1;
+static int ctcount_fd = -1;
+static int ctmax_fd = -1;
+static int sockstat_fd = -1;
+static int orphans_fd = -1;
+static int twmax_fd = -1;
+static int tcpmem_fd = -1;
+
+/* ============================================================================ */
+
+static int open_one(const char *name)
+{
+	int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1)
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", name, errno, strerror(errno));
+
+	return fd;
+}
+
+int open_headroom(void)
+{
+	close_headroom();
+
+	if (maxfileuse > 0)
+		filenr_fd = open_one(filenr_name);
+
+	if (maxtaskuse > 0) {
+		loadavg_fd = open_one(loadavg_name);
+		threadsmax_fd = open_one(threadsmax_name);
+	}
+
+	if (maxtaskuse > 0 || maxzombieuse > 0)
+		pidmax_fd = open_one(pidmax_name);
+
+	if (maxconntrackuse > 0) {
+		ctcount_fd = open_one(ctcount_name);
+		ctmax_fd = open_one(ctmax_name);
+	}
+
+	if (maxsocketuse > 0) {
+		sockstat_fd = open_one(sockstat_name);
+		orphans_fd = open_one(orphans_name);
+		twmax_fd = open_one(twmax_name);
+		tcpmem_fd = open_one(tcpmem_name);
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Read up to 'n' numbers from a /proc file, skipping anything between them. For
+ * /proc/loadavg that means the load averages are read as well, but they are not
+ * needed. Returns the count of numbers found, or -1 on error.
+ */
+
+static int read_numbers(int fd, const char *name, unsigned long long *vals, int n)
+{
+	char buf[128], *ptr, *end;
+	int len, count = 0;
+
+	if ((len = pread(fd, buf, sizeof(buf) - 1, 0)) < 0) {
+		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", name, errno, strerror(errno));
+		return -1;
+	}
+	buf[len] = 0;
+
+	for (ptr = buf; *ptr && count < n; ptr = end) {
+		while (*ptr && (*ptr < '0' || *ptr > '9'))
+			ptr++;
+		if (*ptr == 0)
+			break;
+		vals[count++] = strtoull(ptr, &end, 10);
+		/* skip fractions, such as the ".05" of a load average */
+		while (*end == '.' || (*end >= '0' && *end <= '9'))
+			end++;
+	}
+
+	return count;
+}
+
+/* Returns TRUE if 'used' is more than 'percent' of 'limit'. */
+static int over(unsigned long long used, unsigned long long limit, int percent)
+{
+	return limit > 0 && 100 * used > (unsigned long long)percent * limit;
+}
+
+int check_headroom(void)
+{
+	unsigned long long v[8], pid_max = 0, limit;
+	unsigned int zombies;
+	int err = ENOERR;
+
+	if (pidmax_fd != -1 && read_numbers(pidmax_fd, pidmax_name, &pid_max, 1) != 1)
+		pid_max = 0;
+
+	if (filenr_fd != -1 && read_numbers(filenr_fd, filenr_name, v, 3) == 3) {
+		/* Format is "allocated unused max", unused is always 0 on current kernels. */
+		unsigned long long used = v[0] - v[1];
+
+		if (over(used, v[2], maxfileuse)) {
+			log_message(LOG_ERR, "%llu of %llu open files is more than %d%%", used, v[2], maxfileuse);
+			err = ENFILE;
+		} else if (verbose && logtick && ticker == 1) {
+			log_message(LOG_DEBUG, "%llu of %llu open files in use", used, v[2]);
+		}
+	}
+
+	if (loadavg_fd != -1 && read_numbers(loadavg_fd, loadavg_name, v, 5) == 5) {
+		/* Format is "0.01 0.05 0.10 1/234 5678", so the total is the fifth number. */
+		unsigned long long tasks = v[4];
+
+		limit = pid_max;
+		if (threadsmax_fd != -1 && read_numbers(threadsmax_fd, threadsmax_name, v, 1) == 1)
+			if (limit == 0 || v[0] < limit)
+				limit = v[0];
+
+		if (over(tasks, limit, maxtaskuse)) {
+			log_message(LOG_ERR, "%llu tasks is more than %d%% of the limit of %llu", tasks, maxtaskuse, limit);
+			err = EAGAIN;
+		} else if (verbose && logtick && ticker == 1) {
+			log_message(LOG_DEBUG, "%llu tasks running, limit is %llu", tasks, limit);
+		}
+	}
+
+	if (maxzombieuse > 0 && procscan_zombies(&zombies)) {
+		if (over(zombies, pid_max, maxzombieuse)) {
+			log_message(LOG_ERR, "%u zombie processes is more than %d%% of pid_max %llu", zombies, maxzombieuse, pid_max);
+			err = EAGAIN;
+		}
+	}
+
+	if (ctcount_fd != -1 && ctmax_fd != -1 &&
+	    read_numbers(ctcount_fd, ctcount_name, &v[0], 1) == 1 && read_numbers(ctmax_fd, ctmax_name, &v[1], 1) == 1) {
+		if (over(v[0], v[1], maxconntrackuse)) {
+			log_message(LOG_ERR, "%llu of %llu tracked connections is more than %d%%", v[0], v[1], maxconntrackuse);
+			err = ENOBUFS;
+		} else if (verbose && logtick && ticker == 1) {
+			log_message(LOG_DEBUG, "%llu of %llu tracked connections in use", v[0], v[1]);
+		}
+	}
+
+	/* Format is "sockets: used 1\nTCP: inuse 2 orphan 3 tw 4 alloc 5 mem 6\n..." */
+	if (sockstat_fd != -1 && read_numbers(sockstat_fd, sockstat_name, v, 6) == 6) {
+		unsigned long long orphan = v[2], tw = v[3], mem = v[5], lim[3];
+
+		if (orphans_fd != -1 && read_numbers(orphans_fd, orphans_name, lim, 1) == 1 &&
+		    over(orphan, lim[0], maxsocketuse)) {
+			log_message(LOG_ERR, "%llu orphaned TCP sockets is more than %d%% of %llu", orphan, maxsocketuse, lim[0]);
+			err = ENOBUFS;
+		}
+
+		if (twmax_fd != -1 && read_numbers(twmax_fd, twmax_name, lim, 1) == 1 &&
+		    over(tw, lim[0], maxsocketuse)) {
+			log_message(LOG_ERR, "%llu TCP sockets in TIME-WAIT is more than %d%% of %llu", tw, maxsocketuse, lim[0]);
+			err = ENOBUFS;
+		}
+
+		if (tcpmem_fd != -1 && read_numbers(tcpmem_fd, tcpmem_name, lim, 3) == 3 &&
+		    over(mem, lim[2], maxsocketuse)) {
+			log_message(LOG_ERR, "%llu pages of TCP memory is more than %d%% of %llu", mem, maxsocketuse, lim[2]);
+			err = ENOBUFS;
+		}
+
+		if (verbose && logtick && ticker == 1)
+			log_message(LOG_DEBUG, "%llu sockets used, TCP %llu orphaned, %llu in TIME-WAIT, %llu pages",
+				v[0], orphan, tw, mem);
+	}
+
+	return (err);
+}
+
+/* ============================================================================ */
+
+int close_headroom(void)
+{
+	if (filenr_fd != -1)
+		close(filenr_fd);
+	if (loadavg_fd != -1)
+		close(loadavg_fd);
+	if (pidmax_fd != -1)
+		close(pidmax_fd);
+	if (threadsmax_fd != -1)
+		close(threadsmax_fd);
+	if (ctcount_fd != -1)
+		close(ctcount_fd);
+	if (ctmax_fd != -1)
+		close(ctmax_fd);
+	if (sockstat_fd != -1)
+		close(sockstat_fd);
+	if (orphans_fd != -1)
+		close(orphans_fd);
+	if (twmax_fd != -1)
+		close(twmax_fd);
+	if (tcpmem_fd != -1)
+		close(tcpmem_fd);
+
+	filenr_fd = loadavg_fd = pidmax_fd = threadsmax_fd = -1;
+	ctcount_fd = ctmax_fd = sockstat_fd = orphans_fd = twmax_fd = tcpmem_fd = -1;
+	return 0;
+}
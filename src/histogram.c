@@ -0,0 +1,70 @@
+/* > histogram.c
+ *
+ * Log-linear histograms of times in microseconds, as used by the latency and
+ * disk probe checks. Buckets are exact for the first HIST_LINEAR microseconds,
+ * after that each power of 2 is split in to HIST_SUB buckets, so a time is known
+ * to within 1/HIST_SUB of its value.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "extern.h"
+
+int hist_bucket(unsigned int us)
+{
+	int bits;
+
+	if (us < HIST_LINEAR)
+		return us;
+
+	bits = 31 - __builtin_clz(us);	/* bits >= 6 here */
+	return HIST_LINEAR + (bits - 6) * HIST_SUB + ((us >> (bits - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Largest time (in microseconds) that falls in to a given bucket. */
+unsigned int hist_limit(int idx)
+{
+	int bits, sub;
+
+	if (idx < HIST_LINEAR)
+		return idx;
+
+	bits = (idx - HIST_LINEAR) / HIST_SUB + 6;
+	sub = (idx - HIST_LINEAR) % HIST_SUB;
+	return ((HIST_SUB + sub + 1) << (bits - HIST_SUB_BITS)) - 1;
+}
+
+/*
+ * Return the given percentile of the HIST_BUCKETS counts in 'hist', taking the
+ * times in its bucket as spread evenly over the bucket, or 0 if it is empty.
+ */
+
+unsigned int hist_percentile(const unsigned int *hist, int percent)
+{
+	unsigned long long total = 0, sum = 0, want;
+	int ii;
+
+	for (ii = 0; ii < HIST_BUCKETS; ii++)
+		total += hist[ii];
+
+	if (total == 0)
+		return 0;
+
+	/* Rank of the sample we want, counting from 1. */
+	want = (total * percent + 99) / 100;
+
+	for (ii = 0; ii < HIST_BUCKETS; ii++) {
+		if (hist[ii] > 0 && sum + hist[ii] >= want) {
+			unsigned int lo = (ii == 0) ? 0 : hist_limit(ii - 1) + 1;
+			unsigned int hi = hist_limit(ii);
+
+			return lo + (unsigned int)((unsigned long long)(hi - lo) * (want - sum) / hist[ii]);
+		}
+		sum += hist[ii];
+	}
+
+	return hist_limit(HIST_BUCKETS - 1);
+}
@@ -0,0 +1,240 @@
+/* > hwerror.c
+ *
+ * Code for checking the kernel's hardware error counters: memory errors found
+ * by EDAC (ce_count and ue_count for each memory controller) and PCIe errors
+ * found by AER (aer_dev_correctable, aer_dev_nonfatal and aer_dev_fatal for
+ * each device). Corrected errors climbing quickly often come before one that
+ * can't be corrected, and so a crash.
+ *
+ * The counter files are found once at start-up, kept open and read with pread()
+ * each interval. Corrected errors are checked as a rate: the increase over the
+ * last 'hw-error-period' seconds, from a ring of samples taken through that
+ * period. Uncorrected errors are checked as the increase since start-up.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+#include <time.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define HW_SAMPLES	8		/* samples kept over the period */
+
+struct hwcounter {
+	char *name;
+	int fd;
+	int corrected;				/* else uncorrected (or fatal) */
+	unsigned long long start;	/* value at start-up */
+	unsigned long long value[HW_SAMPLES];
+	time_t when[HW_SAMPLES];
+	int next;
+};
+
+static const struct {
+	const char *pattern;
+	int corrected;
+} hw_files[] = {
+	{ "/sys/devices/system/edac/mc/mc*/ce_count", TRUE },
+	{ "/sys/devices/system/edac/mc/mc*/ue_count", FALSE },
+	{ "/sys/bus/pci/devices/*/aer_dev_correctable", TRUE },
+	{ "/sys/bus/pci/devices/*/aer_dev_nonfatal", FALSE },
+	{ "/sys/bus/pci/devices/*/aer_dev_fatal", FALSE },
+	{ NULL, 0 }
+};
+
+static struct hwcounter *counters = NULL;
+static int ncounters = 0;
+static time_t next_sample = 0;
+static time_t start_time = 0;
+
+/*
+ * Read a counter. The EDAC files hold just the number, the AER ones a line for
+ * each type of error followed by "TOTAL_ERR_COR 3" (or similar), which is used.
+ */
+
+static int read_counter(struct hwcounter *hc, unsigned long long *value)
+{
+	char buf[1024], *ptr;
+	int len;
+
+	if ((len = pread(hc->fd, buf, sizeof(buf) - 1, 0)) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", hc->name, err, strerror(err));
+		return (err);
+	}
+	buf[len] = 0;
+
+	ptr = strstr(buf, "TOTAL_");
+	if (ptr != NULL)
+		ptr = strchr(ptr, ' ');
+	else
+		ptr = buf;
+
+	if (ptr == NULL) {
+		log_message(LOG_ERR, "no total found in %s", hc->name);
+		return (EINVAL);
+	}
+
+	*value = strtoull(ptr, NULL, 10);
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int open_hwerror(void)
+{
+	int ii;
+	size_t jj;
+
+	close_hwerror();
+
+	if (!hw_errors)
+		return -1;
+
+	if (hw_error_period <= 0)
+		hw_error_period = 3600;
+
+	for (ii = 0; hw_files[ii].pattern != NULL; ii++) {
+		glob_t gl;
+
+		if (glob(hw_files[ii].pattern, 0, NULL, &gl) != 0)
+			continue;
+
+		for (jj = 0; jj < gl.gl_pathc; jj++) {
+			struct hwcounter *bigger, *hc;
+			int fd = open(gl.gl_pathv[jj], O_RDONLY | O_CLOEXEC);
+
+			if (fd == -1) {
+				log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", gl.gl_pathv[jj], errno, strerror(errno));
+				continue;
+			}
+
+			bigger = realloc(counters, (ncounters + 1) * sizeof(struct hwcounter));
+			if (bigger == NULL) {
+				close(fd);
+				break;
+			}
+			counters = bigger;
+
+			hc = &counters[ncounters];
+			memset(hc, 0, sizeof(*hc));
+			hc->name = xstrdup(gl.gl_pathv[jj]);
+			hc->fd = fd;
+			hc->corrected = hw_files[ii].corrected;
+
+			if (read_counter(hc, &hc->start) != ENOERR) {
+				close(fd);
+				free(hc->name);
+				continue;
+			}
+			ncounters++;
+
+			if (verbose)
+				log_message(LOG_DEBUG, "hardware error counter %s = %llu", hc->name, hc->start);
+		}
+
+		globfree(&gl);
+	}
+
+	if (ncounters == 0)
+		log_message(LOG_WARNING, "no EDAC or AER error counters found");
+
+	start_time = mono_seconds();
+	next_sample = start_time + hw_error_period / HW_SAMPLES;
+	return 0;
+}
+
+/* ============================================================================ */
+
+int check_hwerror(void)
+{
+	time_t now;
+	int ii, sample, err = ENOERR;
+
+	if (ncounters == 0)
+		return (ENOERR);
+
+	now = mono_seconds();
+	sample = (now >= next_sample);
+	if (sample)
+		next_sample = now + hw_error_period / HW_SAMPLES;
+
+	for (ii = 0; ii < ncounters; ii++) {
+		struct hwcounter *hc = &counters[ii];
+		unsigned long long value, base, rise;
+		int jj, res;
+
+		if ((res = read_counter(hc, &value)) != ENOERR) {
+			err = res;
+			continue;
+		}
+
+		if (!hc->corrected) {
+			rise = (value > hc->start) ? value - hc->start : 0;
+
+			if (rise > (unsigned long long)max_uncorrected) {
+				log_message(LOG_ERR, "%s has risen by %llu since start-up (more than %d)",
+					hc->name, rise, max_uncorrected);
+				err = EHWERR;
+			}
+			continue;
+		}
+
+		/* Compare with the oldest sample that is within the period (or start-up). */
+		base = hc->start;
+		if (now - start_time > hw_error_period) {
+			time_t oldest = now;
+			for (jj = 0; jj < HW_SAMPLES; jj++) {
+				if (hc->when[jj] != 0 && now - hc->when[jj] <= hw_error_period && hc->when[jj] < oldest) {
+					oldest = hc->when[jj];
+					base = hc->value[jj];
+				}
+			}
+		}
+		rise = (value > base) ? value - base : 0;
+
+		if (sample) {
+			hc->value[hc->next] = value;
+			hc->when[hc->next] = now;
+			hc->next = (hc->next + 1) % HW_SAMPLES;
+		}
+
+		if (verbose && logtick && ticker == 1)
+			log_message(LOG_DEBUG, "%s = %llu (%llu in the last %d seconds)", hc->name, value, rise, hw_error_period);
+
+		if (max_corrected > 0 && rise > (unsigned long long)max_corrected) {
+			log_message(LOG_ERR, "%s has risen by %llu in %d seconds (more than %d)",
+				hc->name, rise, hw_error_period, max_corrected);
+			err = EHWERR;
+		}
+	}
+
+	return (err);
+}
+
+/* ============================================================================ */
+
+int close_hwerror(void)
+{
+	int ii;
+
+	for (ii = 0; ii < ncounters; ii++) {
+		close(counters[ii].fd);
+		free(counters[ii].name);
+	}
+
+	free(counters);
+	counters = NULL;
+	ncounters = 0;
+	return 0;
+}
@@ -0,0 +1,304 @@
+/* > kmsg.c
+ *
+ * Code for watching the kernel log for messages that often come before a hang,
+ * such as "soft lockup", "hung_task", "Out of memory: Killed process" or
+ * "EXT4-fs error".
+ *
+ * /dev/kmsg is kept open non-blocking in the main loop's ppoll() set, and each
+ * record read from it is passed through an Aho-Corasick matcher built from all
+ * of the 'kmsg-pattern' entries at start-up. That finds every pattern in one
+ * pass over the text whatever the number of patterns, and nothing is allocated
+ * once it is built.
+ *
+ * Each pattern has its own error code, and a count of matches within a period
+ * that must be reached before it is reported. The times of the latest matches
+ * are kept in a ring, using the kernel's own time-stamp for each record.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define KMSG_RECORD_MAX	8192		/* longest record the kernel gives */
+#define KMSG_COUNT_MAX	1000
+
+static const char kmsg_name[] = "/dev/kmsg";
+static int kmsg_fd = -1;
+static char record[KMSG_RECORD_MAX + 1];
+
+/*
+ * The matcher as a full state machine: 'delta' gives the next state for each
+ * state and byte, 'out' the pattern (if any) that ends at a state, and 'dict'
+ * the next shorter suffix of it that is also the end of a pattern (0 if none).
+ */
+static int nstates = 0;
+static int *delta = NULL;
+static int *out = NULL;
+static int *dict = NULL;
+static struct list **pattern = NULL;
+
+static int kmsg_event(int fd, short revents, void *arg);
+
+/* ============================================================================ */
+
+static int build_matcher(struct list *klist)
+{
+	struct list *act;
+	int npat = 0, maxstates = 1, ii, c, head, tail;
+	int *fail, *queue;
+
+	for (act = klist; act != NULL; act = act->next) {
+		maxstates += strlen(act->name);
+		npat++;
+	}
+
+	delta = xcalloc((size_t)maxstates * 256, sizeof(int));
+	out = xcalloc(maxstates, sizeof(int));
+	dict = xcalloc(maxstates, sizeof(int));
+	fail = xcalloc(maxstates, sizeof(int));
+	queue = xcalloc(maxstates, sizeof(int));
+	pattern = xcalloc(npat, sizeof(struct list *));
+
+	/* The trie of patterns, with -1 for no transition. */
+	for (ii = 0; ii < maxstates * 256; ii++)
+		delta[ii] = -1;
+	for (ii = 0; ii < maxstates; ii++)
+		out[ii] = -1;
+	nstates = 1;
+
+	for (act = klist, npat = 0; act != NULL; act = act->next) {
+		const unsigned char *ptr;
+		int state = 0;
+
+		if (act->name[0] == 0)
+			continue;
+
+		for (ptr = (const unsigned char *)act->name; *ptr; ptr++) {
+			if (delta[state * 256 + *ptr] == -1)
+				delta[state * 256 + *ptr] = nstates++;
+			state = delta[state * 256 + *ptr];
+		}
+
+		if (out[state] != -1) {
+			log_message(LOG_WARNING, "kernel message pattern \"%s\" given twice, ignoring the second", act->name);
+			continue;
+		}
+
+		pattern[npat] = act;
+		out[state] = npat++;
+	}
+
+	/* Fill in the failure transitions breadth first, so shorter states are done first. */
+	head = tail = 0;
+	for (c = 0; c < 256; c++) {
+		int next = delta[c];
+		if (next == -1) {
+			delta[c] = 0;
+		} else {
+			fail[next] = 0;
+			queue[tail++] = next;
+		}
+	}
+
+	while (head < tail) {
+		int state = queue[head++];
+
+		for (c = 0; c < 256; c++) {
+			int next = delta[state * 256 + c];
+			int back = delta[fail[state] * 256 + c];
+
+			if (next == -1) {
+				delta[state * 256 + c] = back;
+			} else {
+				fail[next] = back;
+				dict[next] = (out[back] != -1) ? back : dict[back];
+				queue[tail++] = next;
+			}
+		}
+	}
+
+	free(fail);
+	free(queue);
+	return npat;
+}
+
+int open_kmsg(struct list *klist)
+{
+	struct list *act;
+
+	close_kmsg();
+
+	if (klist == NULL)
+		return -1;
+
+	for (act = klist; act != NULL; act = act->next) {
+		struct kmsgmode *km = &act->parameter.kmsg;
+
+		if (km->code <= 0 || km->code > 255)
+			km->code = EKMSG;
+		if (km->count <= 0)
+			km->count = 1;
+		if (km->count > KMSG_COUNT_MAX)
+			km->count = KMSG_COUNT_MAX;
+		if (km->period <= 0)
+			km->period = 60;
+		km->times = xcalloc(km->count, sizeof(unsigned long long));
+		km->next = 0;
+		km->last_seq = 0;
+	}
+
+	kmsg_fd = open(kmsg_name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (kmsg_fd == -1) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", kmsg_name, errno, strerror(errno));
+		close_kmsg();
+		return -1;
+	}
+
+	/* Only look at messages from now on. */
+	lseek(kmsg_fd, 0, SEEK_END);
+
+	build_matcher(klist);
+
+	if (add_event_fd(kmsg_fd, POLLIN, kmsg_event, NULL, NULL) != 0) {
+		log_message(LOG_ERR, "kernel messages will not be watched");
+		close_kmsg();
+		return -1;
+	}
+
+	if (verbose)
+		log_message(LOG_DEBUG, "watching %s with %d matcher states", kmsg_name, nstates);
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Note a match of a pattern at time 'usec' (from the record), returning the
+ * pattern's error code once it has been seen 'count' times within 'period'.
+ */
+
+static int pattern_hit(struct list *act, unsigned long long seq, unsigned long long usec, const char *text)
+{
+	struct kmsgmode *km = &act->parameter.kmsg;
+	unsigned long long oldest;
+
+	/* Only count a pattern once per record. */
+	if (km->last_seq == seq + 1)
+		return (ENOERR);
+	km->last_seq = seq + 1;
+
+	km->times[km->next] = usec;
+	km->next = (km->next + 1) % km->count;
+	oldest = km->times[km->next];
+
+	if (verbose)
+		log_message(LOG_DEBUG, "kernel message matches \"%s\": %s", act->name, text);
+
+	/* Are the last 'count' matches (the whole ring) all within the period? */
+	if (oldest == 0 || usec - oldest > 1000000ULL * km->period)
+		return (ENOERR);
+
+	log_message(LOG_ERR, "kernel message \"%s\" seen %d time(s) within %d seconds: %s",
+		act->name, km->count, km->period, text);
+	return (km->code);
+}
+
+/*
+ * Called from the main loop's ppoll() when there are kernel messages to read.
+ * Each read() gives one record "prio,seq,usec,flags;text\n" that may be
+ * followed by lines of extra information, which are ignored.
+ *
+ * A pattern that has been seen often enough is reported against its own entry,
+ * so retry-timeout and repair-maximum apply to each pattern separately.
+ */
+
+static int kmsg_event(int fd, short revents GCC_UNUSED, void *arg GCC_UNUSED)
+{
+	int err = EDONTKNOW;
+
+	for (;;) {
+		unsigned long long seq, usec;
+		char *text, *end, *ptr;
+		int state = 0, n, res;
+
+		n = read(fd, record, KMSG_RECORD_MAX);
+		if (n < 0) {
+			if (errno == EAGAIN)
+				break;
+			if (errno == EPIPE) {
+				/* Records were lost as we were too slow, carry on from the next. */
+				log_message(LOG_WARNING, "some kernel messages were missed");
+				continue;
+			}
+			err = errno;
+			log_message(LOG_ERR, "read %s gave errno = %d = '%s'", kmsg_name, err, strerror(err));
+			break;
+		}
+		if (n == 0)
+			break;
+		record[n] = 0;
+
+		text = strchr(record, ';');
+		if (text == NULL)
+			continue;
+		*text++ = 0;
+		if ((end = strchr(text, '\n')) != NULL)
+			*end = 0;
+
+		strtoul(record, &ptr, 10);
+		seq = strtoull(ptr + (*ptr == ','), &ptr, 10);
+		usec = strtoull(ptr + (*ptr == ','), &ptr, 10);
+
+		for (ptr = text; *ptr; ptr++) {
+			int match;
+
+			state = delta[state * 256 + (unsigned char)*ptr];
+			for (match = (out[state] != -1) ? state : dict[state]; match != 0; match = dict[match]) {
+				res = pattern_hit(pattern[out[match]], seq, usec, text);
+				if (res != ENOERR)
+					report_event(res, pattern[out[match]]);
+			}
+		}
+	}
+
+	return (err);
+}
+
+/* ============================================================================ */
+
+int close_kmsg(void)
+{
+	struct list *act;
+
+	if (kmsg_fd != -1) {
+		remove_event_fd(kmsg_fd);
+		close(kmsg_fd);
+	}
+	kmsg_fd = -1;
+
+	for (act = kmsg_list; act != NULL; act = act->next) {
+		free(act->parameter.kmsg.times);
+		act->parameter.kmsg.times = NULL;
+	}
+
+	free(delta);
+	free(out);
+	free(dict);
+	free(pattern);
+	delta = out = dict = NULL;
+	pattern = NULL;
+	nstates = 0;
+	return 0;
+}
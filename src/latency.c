@@ -0,0 +1,273 @@
+/* > latency.c
+ *
+ * Code for measuring the scheduling latency seen on each CPU, rather like a
+ * built-in version of the 'cyclictest' program. A soft lock-up or a run-away
+ * real-time task can starve one CPU while the main loop happily runs on another
+ * and keeps refreshing the watchdog, so none of the other tests notice.
+ *
+ * One small "canary" thread is started per CPU (or per CPU in the configured
+ * set) and pinned to it. Each wakes on an absolute timer every latency-period
+ * microseconds and records how late it was in a histogram for that CPU. The
+ * main loop then collects & clears the histograms once per interval and checks
+ * the 99th percentile and maximum latency against the limits.
+ *
+ * The threads inherit the scheduling policy of the daemon, so when 'realtime'
+ * is set they run at the same real-time priority as the main loop.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE		/* For CPU_SET() and pthread_setaffinity_np() */
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+struct canary {
+	int cpu;
+	pthread_t thread;
+	int started;
+	unsigned int hist[HIST_BUCKETS];	/* updated by canary, cleared by main loop */
+	unsigned int max_us;			/* as above */
+	long long last_wake;			/* monotonic time of last wake-up (ns) */
+};
+
+static struct canary *canaries = NULL;
+static int ncanaries = 0;
+static volatile int canary_stop = FALSE;
+
+/* ============================================================================ */
+
+static void *canary_thread(void *arg)
+{
+	struct canary *c = arg;
+	struct timespec next;
+	const long period_ns = 1000L * latency_period;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!canary_stop) {
+		long long late, now;
+		unsigned int us, old;
+
+		next.tv_nsec += period_ns;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			;
+
+		now = mono_ns();
+		late = now - ((long long)next.tv_sec * 1000000000LL + next.tv_nsec);
+		if (late < 0)
+			late = 0;
+
+		us = (late / 1000 > 0x7fffffffLL) ? 0x7fffffff : (unsigned int)(late / 1000);
+
+		__atomic_add_fetch(&c->hist[hist_bucket(us)], 1, __ATOMIC_RELAXED);
+		old = __atomic_load_n(&c->max_us, __ATOMIC_RELAXED);
+		while (us > old && !__atomic_compare_exchange_n(&c->max_us, &old, us, FALSE,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+		__atomic_store_n(&c->last_wake, now, __ATOMIC_RELAXED);
+
+		/* If we were held off for more than a period, don't try to catch up. */
+		if (late > period_ns) {
+			next.tv_sec  = now / 1000000000LL;
+			next.tv_nsec = now % 1000000000LL;
+		}
+	}
+
+	return NULL;
+}
+
+/* ============================================================================ */
+
+/*
+ * Parse a CPU list of the kernel's form, for example "0-3,8,10-11".
+ */
+
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+
+	while (*p) {
+		char *end;
+		unsigned long first, last;
+
+		first = last = strtoul(p, &end, 10);
+		if (end == p)
+			return -1;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p)
+				return -1;
+		}
+
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+
+		p = end;
+		while (*p == ',' || *p == ' ')
+			p++;
+	}
+
+	return 0;
+}
+
+int open_latency(void)
+{
+	cpu_set_t set;
+	int cpu, rv = 0;
+
+	close_latency();
+
+	if (maxlatency <= 0 && maxlatency_p99 <= 0)
+		return -1;
+
+	if (latency_period <= 0)
+		latency_period = 1000;
+
+	if (latency_cpus != NULL) {
+		if (parse_cpu_list(latency_cpus, &set) != 0) {
+			log_message(LOG_ERR, "invalid CPU list '%s' for latency check", latency_cpus);
+			return -1;
+		}
+	} else if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		log_message(LOG_ERR, "cannot get CPU affinity (errno = %d = '%s')", errno, strerror(errno));
+		return -1;
+	}
+
+	canaries = xcalloc(CPU_COUNT(&set), sizeof(struct canary));
+	canary_stop = FALSE;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		struct canary *c;
+		cpu_set_t one;
+		pthread_attr_t attr;
+		int err;
+
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+
+		c = &canaries[ncanaries];
+		c->cpu = cpu;
+		c->last_wake = mono_ns();
+
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, 65536);
+		pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+
+		err = pthread_create(&c->thread, &attr, canary_thread, c);
+		pthread_attr_destroy(&attr);
+
+		if (err != 0) {
+			log_message(LOG_WARNING, "cannot start latency canary on CPU %d (errno = %d = '%s')",
+				cpu, err, strerror(err));
+			rv = -1;
+			continue;
+		}
+
+		c->started = TRUE;
+		ncanaries++;
+	}
+
+	if (verbose)
+		log_message(LOG_DEBUG, "started %d latency canary thread(s)", ncanaries);
+
+	return rv;
+}
+
+/* ============================================================================ */
+
+int check_latency(void)
+{
+	int ii, jj, err = ENOERR;
+	long long now;
+
+	if (canaries == NULL)
+		return (ENOERR);
+
+	now = mono_ns();
+
+	for (ii = 0; ii < ncanaries; ii++) {
+		struct canary *c = &canaries[ii];
+		unsigned int count[HIST_BUCKETS];
+		unsigned long total = 0;
+		unsigned int max_us, p99;
+		long long idle_us;
+
+		/* Collect & clear this CPU's histogram. */
+		for (jj = 0; jj < HIST_BUCKETS; jj++) {
+			count[jj] = __atomic_exchange_n(&c->hist[jj], 0, __ATOMIC_RELAXED);
+			total += count[jj];
+		}
+		max_us = __atomic_exchange_n(&c->max_us, 0, __ATOMIC_RELAXED);
+
+		/*
+		 * A canary that has not woken at all is starved, and the time since it
+		 * last ran is at least as bad as its latency.
+		 */
+		idle_us = (now - __atomic_load_n(&c->last_wake, __ATOMIC_RELAXED)) / 1000 - latency_period;
+		if (idle_us > 0 && idle_us > max_us)
+			max_us = (idle_us > 0x7fffffffLL) ? 0x7fffffff : (unsigned int)idle_us;
+
+		p99 = hist_percentile(count, 99);
+
+		if (verbose && logtick && ticker == 1)
+			log_message(LOG_DEBUG, "CPU %d latency p99 %u us, max %u us (%lu wake-ups)",
+				c->cpu, p99, max_us, total);
+
+		if (maxlatency > 0 && max_us > maxlatency) {
+			log_message(LOG_ERR, "CPU %d scheduling latency %u us is more than %d us",
+				c->cpu, max_us, maxlatency);
+			err = ELATENCY;
+		} else if (maxlatency_p99 > 0 && p99 > maxlatency_p99) {
+			log_message(LOG_ERR, "CPU %d 99th percentile scheduling latency %u us is more than %d us",
+				c->cpu, p99, maxlatency_p99);
+			err = ELATENCY;
+		}
+	}
+
+	return (err);
+}
+
+/* ============================================================================ */
+
+int close_latency(void)
+{
+	int ii;
+
+	if (canaries != NULL) {
+		canary_stop = TRUE;
+		for (ii = 0; ii < ncanaries; ii++) {
+			if (canaries[ii].started) {
+				pthread_cancel(canaries[ii].thread);
+				pthread_join(canaries[ii].thread, NULL);
+			}
+		}
+		free(canaries);
+	}
+
+	canaries = NULL;
+	ncanaries = 0;
+	return 0;
+}
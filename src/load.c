@@ -8,18 +8,10 @@
 #include "config.h"
 #endif
 
-#include <errno.h>
-#include <unistd.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
 #include "extern.h"
 #include "watch_err.h"
 
-static int load_fd = -1;
-static const char load_name[] = "/proc/loadavg";
+static int load_in_use = FALSE;
 
 /* ============================================================================ */
 
@@ -29,14 +21,12 @@ int open_loadcheck(void)
 
 	close_loadcheck();
 
-	if (maxload1 || maxload5 || maxload15) {
-		/* open the load average file */
-		load_fd = open(load_name, O_RDONLY);
-		if (load_fd == -1) {
-			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", load_name, errno, strerror(errno));
-		} else {
-			rv = 0;
-		}
+	if (maxload1 || maxload5 || maxload15 ||
+		maxload1_cpu || maxload5_cpu || maxload15_cpu ||
+		maxrunning > 0 || maxblocked > 0) {
+		/* the load averages come from the per-interval snapshot, see snapshot.c */
+		load_in_use = TRUE;
+		rv = 0;
 	}
 
 	return rv;
@@ -44,60 +34,77 @@ int open_loadcheck(void)
 
 /* ============================================================================ */
 
+/*
+ * Work out the load limit to use from the absolute value and the per-CPU one
+ * (scaled by the number of on-line CPUs right now). Where both are given the
+ * lower one applies, zero means no limit.
+ */
+
+static unsigned long load_limit(int maxload, int maxload_cpu)
+{
+	unsigned long limit = maxload;
+
+	if (maxload_cpu > 0) {
+		unsigned long cpu_limit = (unsigned long)maxload_cpu * sys_snap.ncpus;
+		if (limit == 0 || cpu_limit < limit)
+			limit = cpu_limit;
+	}
+
+	return limit;
+}
+
+/* ============================================================================ */
+
 int check_load(void)
 {
-	int avg1, avg5, avg15;
-	char buf[40], *ptr;
-	int n;
+	unsigned long avg1, avg5, avg15;
+	unsigned long lim1, lim5, lim15;
 
-	/* is the load average file open? */
-	if (load_fd == -1)
+	/* is the load average check in use? */
+	if (!load_in_use || !sys_snap.valid)
 		return (ENOERR);
 
-	/* position pointer at start of file */
-	if (lseek(load_fd, 0, SEEK_SET) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "lseek %s gave errno = %d = '%s'", load_name, err, strerror(err));
-		return (err);
-	}
-
-	/* read the line (there is only one) */
-	if ((n = read(load_fd, buf, sizeof(buf)-1)) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", load_name, err, strerror(err));
-		return (err);
-	}
-	/* Force string to be nul-terminated. */
-	buf[n] = 0;
-	/* we only care about integer values */
-	avg1 = atoi(buf);
-
-	/* if we have incorrect data we might not be able to find */
-	/* the blanks we're looking for */
-	ptr = strchr(buf, ' ');
-	if (ptr != NULL) {
-		avg5 = atoi(ptr);
-		ptr = strchr(ptr + 1, ' ');
+	/* these are fixed-point values, scaled by LOAD_SCALE */
+	avg1  = sys_snap.load[0];
+	avg5  = sys_snap.load[1];
+	avg15 = sys_snap.load[2];
+
+	lim1  = load_limit(maxload1,  maxload1_cpu);
+	lim5  = load_limit(maxload5,  maxload5_cpu);
+	lim15 = load_limit(maxload15, maxload15_cpu);
+
+	if (verbose && logtick && ticker == 1) {
+		log_message(LOG_DEBUG, "current load is %lu.%02lu %lu.%02lu %lu.%02lu (%d CPUs, %lu running, %lu blocked)",
+							LOAD_INT(avg1),  LOAD_FRAC(avg1),
+							LOAD_INT(avg5),  LOAD_FRAC(avg5),
+							LOAD_INT(avg15), LOAD_FRAC(avg15),
+							sys_snap.ncpus, sys_snap.procs_running, sys_snap.procs_blocked);
 	}
 
-	if (ptr != NULL) {
-		avg15 = atoi(ptr);
-	} else {
-		log_message(LOG_ERR, "%s does not contain any data (read = %s)", load_name, buf);
-		return (ENOLOAD);
-	}
+	if ((lim1  > 0 && avg1  > lim1) ||
+		(lim5  > 0 && avg5  > lim5) ||
+		(lim15 > 0 && avg15 > lim15)) {
 
-	if (verbose && logtick && ticker == 1)
-		log_message(LOG_DEBUG, "current load is %d %d %d", avg1, avg5, avg15);
+		log_message(LOG_ERR, "loadavg %lu.%02lu %lu.%02lu %lu.%02lu is higher than the given threshold %lu.%02lu %lu.%02lu %lu.%02lu!",
+							LOAD_INT(avg1),  LOAD_FRAC(avg1),
+							LOAD_INT(avg5),  LOAD_FRAC(avg5),
+							LOAD_INT(avg15), LOAD_FRAC(avg15),
+							LOAD_INT(lim1),  LOAD_FRAC(lim1),
+							LOAD_INT(lim5),  LOAD_FRAC(lim5),
+							LOAD_INT(lim15), LOAD_FRAC(lim15));
 
-	if ((maxload1  > 0 && avg1  > maxload1) ||
-		(maxload5  > 0 && avg5  > maxload5) ||
-		(maxload15 > 0 && avg15 > maxload15)) {
+		return (EMAXLOAD);
+	}
 
-		log_message(LOG_ERR, "loadavg %d %d %d is higher than the given threshold %d %d %d!",
-							avg1, avg5, avg15,
-							maxload1, maxload5, maxload15);
+	if (maxrunning > 0 && sys_snap.procs_running > maxrunning) {
+		log_message(LOG_ERR, "%lu running processes is more than the given threshold %d!",
+							sys_snap.procs_running, maxrunning);
+		return (EMAXLOAD);
+	}
 
+	if (maxblocked > 0 && sys_snap.procs_blocked > maxblocked) {
+		log_message(LOG_ERR, "%lu blocked processes is more than the given threshold %d!",
+							sys_snap.procs_blocked, maxblocked);
 		return (EMAXLOAD);
 	}
 
@@ -108,14 +115,6 @@ int check_load(void)
 
 int close_loadcheck(void)
 {
-	int rv = -1;
-
-	if (load_fd != -1 && close(load_fd) == -1) {
-		log_message(LOG_ALERT, "cannot close %s (errno = %d)", load_name, errno);
-	} else {
-		rv = 0;
-	}
-
-	load_fd = -1;
-	return rv;
+	load_in_use = FALSE;
+	return 0;
 }
@@ -0,0 +1,192 @@
+/* > mdraid.c
+ *
+ * Code for checking Linux software RAID (md) arrays. For each 'md-array' the
+ * files degraded, sync_action and array_state in /sys/block/mdN/md are kept
+ * open and read with pread() each interval.
+ *
+ * md notifies array_state and degraded when they change, so both are also in
+ * the main loop's ppoll() set for POLLPRI and a failed disk is seen as soon as
+ * md acts on it, not at the next interval.
+ *
+ * An array with missing or failed members, or one that is no longer running
+ * (array_state of clear, inactive or broken), is reported as EDEGRADED. An array
+ * that is not there at all is reported as ENOENT, and looked for again each
+ * interval in case it is assembled later.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <poll.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+static int md_event(int fd, short revents, void *arg);
+static void close_md(struct mdmode *md);
+
+/* ============================================================================ */
+
+static int open_attr(const char *dev, const char *attr)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/sys/block/%s/md/%s", dev, attr);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * Open the attributes of an array and add them to the ppoll() set. Returns errno
+ * if the array is not there.
+ */
+
+static int open_md(struct list *act)
+{
+	struct mdmode *md = &act->parameter.md;
+	const char *dev = strrchr(act->name, '/');
+
+	/* "md0" or "/dev/md0" */
+	dev = (dev == NULL) ? act->name : dev + 1;
+
+	md->state_fd = open_attr(dev, "array_state");
+	if (md->state_fd == -1)
+		return (errno);
+
+	md->degraded_fd = open_attr(dev, "degraded");
+	md->action_fd = open_attr(dev, "sync_action");
+
+	add_event_fd(md->state_fd, POLLPRI, md_event, act, act);
+	if (md->degraded_fd != -1)
+		add_event_fd(md->degraded_fd, POLLPRI, md_event, act, act);
+
+	return (ENOERR);
+}
+
+int open_mdcheck(struct list *mlist)
+{
+	struct list *act;
+
+	for (act = mlist; act != NULL; act = act->next) {
+		struct mdmode *md = &act->parameter.md;
+		int err;
+
+		md->state_fd = md->degraded_fd = md->action_fd = -1;
+
+		if ((err = open_md(act)) != ENOERR) {
+			log_message(LOG_ERR, "cannot find md array %s (errno = %d = '%s')", act->name, err, strerror(err));
+			continue;
+		}
+
+		/* Reading the attributes in check_mdraid() arms them for the next change. */
+		if (check_mdraid(act) == EDEGRADED)
+			log_message(LOG_WARNING, "md array %s is already degraded", act->name);
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/* Read a sysfs attribute, without the trailing new-line. */
+static int read_attr(int fd, char *buf, size_t size)
+{
+	int n = pread(fd, buf, size - 1, 0);
+
+	if (n < 0)
+		return (errno);
+
+	buf[n] = 0;
+	if (n > 0 && buf[n - 1] == '\n')
+		buf[n - 1] = 0;
+
+	return (ENOERR);
+}
+
+int check_mdraid(struct list *act)
+{
+	struct mdmode *md = &act->parameter.md;
+	char state[32], action[32], degraded[16];
+	int err;
+
+	if (md->state_fd == -1 && open_md(act) != ENOERR) {
+		log_message(LOG_ERR, "md array %s is not present", act->name);
+		return (ENOENT);
+	}
+
+	strcpy(action, "unknown");
+	strcpy(degraded, "0");
+
+	if ((err = read_attr(md->state_fd, state, sizeof(state))) != ENOERR ||
+	    (md->degraded_fd != -1 && (err = read_attr(md->degraded_fd, degraded, sizeof(degraded))) != ENOERR) ||
+	    (md->action_fd != -1 && (err = read_attr(md->action_fd, action, sizeof(action))) != ENOERR)) {
+		log_message(LOG_ERR, "cannot read state of md array %s (errno = %d = '%s')", act->name, err, strerror(err));
+		/* Stopped, so look for it again next time. */
+		close_md(md);
+		return (err);
+	}
+
+	if (strcmp(state, "clear") == 0 || strcmp(state, "inactive") == 0 || strcmp(state, "broken") == 0) {
+		log_message(LOG_ERR, "md array %s is %s", act->name, state);
+		return (EDEGRADED);
+	}
+
+	if (atoi(degraded) != 0) {
+		log_message(LOG_ERR, "md array %s is degraded, %s device(s) missing (%s)", act->name, degraded, action);
+		return (EDEGRADED);
+	}
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "md array %s is %s (%s)", act->name, state, action);
+
+	return (ENOERR);
+}
+
+/*
+ * Called from the main loop's ppoll() when md notifies a change.
+ */
+
+static int md_event(int fd GCC_UNUSED, short revents GCC_UNUSED, void *arg)
+{
+	struct list *act = arg;
+
+	if (verbose)
+		log_message(LOG_DEBUG, "md array %s has changed", act->name);
+
+	return check_mdraid(act);
+}
+
+/* ============================================================================ */
+
+static void close_md(struct mdmode *md)
+{
+	if (md->state_fd != -1) {
+		remove_event_fd(md->state_fd);
+		close(md->state_fd);
+	}
+	if (md->degraded_fd != -1) {
+		remove_event_fd(md->degraded_fd);
+		close(md->degraded_fd);
+	}
+	if (md->action_fd != -1)
+		close(md->action_fd);
+
+	md->state_fd = md->degraded_fd = md->action_fd = -1;
+}
+
+int close_mdcheck(void)
+{
+	struct list *act;
+
+	for (act = md_list; act != NULL; act = act->next)
+		close_md(&act->parameter.md);
+
+	return 0;
+}
@@ -28,14 +28,11 @@
 #include "extern.h"
 #include "watch_err.h"
 
-#define FREEMEM		"MemFree:"
-#define FREESWAP	"SwapFree:"
-
-static int mem_fd = -1;
-static const char mem_name[] = "/proc/meminfo";
+static int mem_in_use = FALSE;
 
 /*
- * Open the memory information file if such as test is configured.
+ * Enable the free memory check if such as test is configured. The values
+ * themselves come from the per-interval snapshot, see snapshot.c
  */
 
 int open_memcheck(void)
@@ -45,67 +42,34 @@ int open_memcheck(void)
 	close_memcheck();
 
 	if (minpages > 0) {
-		/* open the memory info file */
-		mem_fd = open(mem_name, O_RDONLY);
-		if (mem_fd == -1) {
-			int err = errno;
-			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", mem_name, err, strerror(err));
-		} else {
-			rv = 0;
-		}
+		mem_in_use = TRUE;
+		rv = 0;
 	}
 
 	return rv;
 }
 
 /*
- * Read and check the contents of the memory information file.
+ * Check the free memory and swap reported in the snapshot.
  */
 
 int check_memory(void)
 {
-	char buf[1024], *ptr1, *ptr2;
-	unsigned int free, freemem, freeswap;
-	int n;
+	unsigned long free, freemem, freeswap;
 
-	/* is the memory file open? */
-	if (mem_fd == -1)
+	/* is the memory check in use? */
+	if (!mem_in_use || !sys_snap.valid)
 		return (ENOERR);
 
-	/* position pointer at start of file */
-	if (lseek(mem_fd, 0, SEEK_SET) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "lseek %s gave errno = %d = '%s'", mem_name, err, strerror(err));
-		return (err);
-	}
-
-	/* read the file */
-	if ((n = read(mem_fd, buf, sizeof(buf)-1)) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", mem_name, err, strerror(err));
-		return (err);
-	}
-	/* Force string to be nul-terminated. */
-	buf[n] = 0;
-
-	ptr1 = strstr(buf, FREEMEM);
-	ptr2 = strstr(buf, FREESWAP);
-
-	if (!ptr1 || !ptr2) {
-		log_message(LOG_ERR, "%s contains invalid data (read = %s)", mem_name, buf);
-		return (EINVMEM);
-	}
-
-	/* we only care about integer values */
-	freemem  = atoi(ptr1 + strlen(FREEMEM));
-	freeswap = atoi(ptr2 + strlen(FREESWAP));
+	freemem  = sys_snap.freemem;
+	freeswap = sys_snap.freeswap;
 	free = freemem + freeswap;
 
 	if (verbose && logtick && ticker == 1)
-		log_message(LOG_DEBUG, "currently there are %u + %u kB of free memory+swap available", freemem, freeswap);
+		log_message(LOG_DEBUG, "currently there are %lu + %lu kB of free memory+swap available", freemem, freeswap);
 
 	if (free < minpages * (EXEC_PAGESIZE / 1024)) {
-		log_message(LOG_ERR, "memory %d kB is less than %d pages", free, minpages);
+		log_message(LOG_ERR, "memory %lu kB is less than %d pages", free, minpages);
 		return (ENOMEM);
 	}
 
@@ -113,20 +77,13 @@ int check_memory(void)
 }
 
 /*
- * Close the special memory data file (if open).
+ * Disable the memory check.
  */
 
 int close_memcheck(void)
 {
-	int rv = 0;
-
-	if (mem_fd != -1 && close(mem_fd) == -1) {
-		log_message(LOG_ALERT, "cannot close %s (errno = %d)", mem_name, errno);
-		rv = -1;
-	}
-
-	mem_fd = -1;
-	return rv;
+	mem_in_use = FALSE;
+	return 0;
 }
 
 int check_allocatable(void)
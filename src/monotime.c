@@ -0,0 +1,56 @@
+/* > monotime.c
+ *
+ * Clock helpers shared by the checks. Intervals, retry times and rates use the
+ * monotonic clock, which a step of the system clock does not move.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+#include <sys/time.h>
+
+#include "extern.h"
+
+/* Read 'clk' in nanoseconds. */
+long long clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+time_t mono_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+long long mono_ms(void)
+{
+	return clock_ns(CLOCK_MONOTONIC) / 1000000LL;
+}
+
+long long mono_us(void)
+{
+	return clock_ns(CLOCK_MONOTONIC) / 1000LL;
+}
+
+long long mono_ns(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
+
+/* For timeouts worked out with timeradd() and timersub(). */
+void mono_timeval(struct timeval *tv)
+{
+	long long us = mono_us();
+
+	tv->tv_sec = us / 1000000LL;
+	tv->tv_usec = us % 1000000LL;
+}
@@ -0,0 +1,141 @@
+/* > mountresp.c
+ *
+ * Code for checking that important mounts, such as an NFS home directory or a
+ * SAN volume, still answer. The check is a statfs() of the mount point and,
+ * if 'mount-read' is set, reading the start of its directory as that makes an
+ * NFS client go to the server.
+ *
+ * A mount that has stopped answering can block any call made on it for minutes,
+ * so the calls are only ever made from a helper thread for each mount (see
+ * deadline.c) and the main loop never touches the file system itself. A call
+ * that takes longer than 'mount-timeout' is a time-out, and 'mount-timeout-count'
+ * of them in a row (including intervals where the helper is still stuck) is
+ * reported as ETIMEDOUT.
+ *
+ * The time each call took is kept for each mount for logging.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+/* ============================================================================ */
+
+int open_mountcheck(struct list *mlist)
+{
+	struct list *act;
+
+	if (mount_timeout <= 0)
+		mount_timeout = 5;
+
+	for (act = mlist; act != NULL; act = act->next) {
+		struct mountmode *mm = &act->parameter.mount;
+
+		mm->timeouts = 0;
+		mm->max_us = mm->avg_us = 0;
+		mm->dl = open_deadline();
+		if (mm->dl == NULL)
+			log_message(LOG_ERR, "mount %s will not be checked", act->name);
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/* Called in the helper thread. */
+static int mount_job(void *arg)
+{
+	struct list *act = arg;
+	struct mountmode *mm = &act->parameter.mount;
+	long long start = mono_us();
+	struct statfs sfs;
+
+	if (statfs(act->name, &sfs) != 0)
+		return errno;
+
+	if (mount_read) {
+		char buf[1024] __attribute__ ((aligned(8)));
+		int fd = open(act->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (fd == -1)
+			return errno;
+		if (syscall(SYS_getdents64, fd, buf, sizeof(buf)) < 0) {
+			int err = errno;
+			close(fd);
+			return err;
+		}
+		close(fd);
+	}
+
+	mm->job_us = mono_us() - start;
+	return 0;
+}
+
+int check_mount(struct list *act)
+{
+	struct mountmode *mm = &act->parameter.mount;
+	int err;
+
+	if (mm->dl == NULL)
+		return (ENOERR);
+
+	err = run_deadline(mm->dl, mount_job, act, 1000L * mount_timeout);
+
+	if (err == ETIMEDOUT) {
+		mm->timeouts++;
+		if (mm->timeouts < mount_timeout_count) {
+			log_message(LOG_WARNING, "mount %s did not answer within %d seconds (%d time(s))",
+				act->name, mount_timeout, mm->timeouts);
+			return (ENOERR);
+		}
+		log_message(LOG_ERR, "mount %s did not answer within %d seconds %d times in a row",
+			act->name, mount_timeout, mm->timeouts);
+		return (ETIMEDOUT);
+	}
+
+	mm->timeouts = 0;
+
+	if (err != ENOERR) {
+		log_message(LOG_ERR, "cannot check mount %s (errno = %d = '%s')", act->name, err, strerror(err));
+		return (err);
+	}
+
+	/* Keep the worst time, and an average that gives 1/8 weight to the latest. */
+	if (mm->job_us > mm->max_us)
+		mm->max_us = mm->job_us;
+	mm->avg_us = (mm->avg_us == 0) ? mm->job_us : mm->avg_us + (mm->job_us - mm->avg_us) / 8;
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "mount %s answered in %ld us (average %ld us, worst %ld us)",
+			act->name, mm->job_us, mm->avg_us, mm->max_us);
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_mountcheck(void)
+{
+	struct list *act;
+
+	for (act = mount_list; act != NULL; act = act->next) {
+		close_deadline(act->parameter.mount.dl);
+		act->parameter.mount.dl = NULL;
+	}
+
+	return 0;
+}
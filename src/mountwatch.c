@@ -0,0 +1,251 @@
+/* > mountwatch.c
+ *
+ * Code for noticing when an important file system is remounted read-only (as
+ * ext4 does with 'errors=remount-ro') or unmounted. Programs using it then
+ * fail in ways that may not stop them, so the watchdog would keep running.
+ *
+ * /proc/self/mountinfo is kept open and added to the main loop's ppoll() for
+ * POLLPRI, which the kernel gives whenever the mount table changes. Only then
+ * is the table read again, so nothing is done while the mounts stay the same.
+ *
+ * A mount is read-only if either its own options or those of its super block
+ * say "ro". The super block is what an ext4 error changes, leaving the mount's
+ * own options as they were.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+static const char mi_name[] = "/proc/self/mountinfo";
+static int mi_fd = -1;
+static char *mi_buf = NULL;
+static size_t mi_size = 0;
+
+static int mountinfo_event(int fd, short revents, void *arg);
+
+/* ============================================================================ */
+
+static int read_mountinfo(void)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	for (;;) {
+		if (len + 1 >= mi_size) {
+			char *bigger = realloc(mi_buf, 2 * mi_size);
+			if (bigger == NULL) {
+				log_message(LOG_ERR, "cannot grow %s buffer to %lu bytes", mi_name, (unsigned long)(2 * mi_size));
+				return (ENOMEM);
+			}
+			mi_buf = bigger;
+			mi_size *= 2;
+		}
+
+		n = pread(mi_fd, mi_buf + len, mi_size - len - 1, len);
+		if (n < 0) {
+			int err = errno;
+			log_message(LOG_ERR, "read %s gave errno = %d = '%s'", mi_name, err, strerror(err));
+			return (err);
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+
+	mi_buf[len] = 0;
+	return (ENOERR);
+}
+
+/* Undo the kernel's octal escapes (such as "\040" for a space) in place. */
+static void unescape(char *str)
+{
+	char *out = str;
+
+	while (*str) {
+		if (str[0] == '\\' && str[1] >= '0' && str[1] <= '3' &&
+		    str[2] >= '0' && str[2] <= '7' && str[3] >= '0' && str[3] <= '7') {
+			*out++ = (char)(((str[1] - '0') << 6) | ((str[2] - '0') << 3) | (str[3] - '0'));
+			str += 4;
+		} else {
+			*out++ = *str++;
+		}
+	}
+	*out = 0;
+}
+
+/* Is "ro" one of the comma separated options? */
+static int has_ro(const char *opts)
+{
+	return strncmp(opts, "ro", 2) == 0 && (opts[2] == ',' || opts[2] == 0);
+}
+
+/*
+ * Go through the table once, noting for each configured mount point whether it
+ * was found and if it is read-only. Where mounts are stacked the last (top) one
+ * is the one that counts.
+ *
+ * "36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue"
+ */
+
+static int parse_mountinfo(void)
+{
+	struct list *act;
+	char *line, *next;
+	int err;
+
+	if ((err = read_mountinfo()) != ENOERR)
+		return (err);
+
+	for (act = mountwatch_list; act != NULL; act = act->next) {
+		act->parameter.mwatch.found = FALSE;
+		act->parameter.mwatch.readonly = FALSE;
+	}
+
+	for (line = mi_buf; line != NULL && *line; line = next) {
+		char *field[6], *super, *ptr;
+		int ii;
+
+		next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = 0;
+
+		for (ii = 0, ptr = line; ii < 6 && ptr != NULL; ii++) {
+			field[ii] = ptr;
+			ptr = strchr(ptr, ' ');
+			if (ptr != NULL)
+				*ptr++ = 0;
+		}
+		if (ii < 6 || ptr == NULL)
+			continue;
+
+		/* The super block options are the third field after the " - " separator. */
+		super = strstr(ptr, "- ");
+		for (ii = 0; super != NULL && ii < 3; ii++) {
+			super = strchr(super, ' ');
+			if (super != NULL)
+				super++;
+		}
+
+		unescape(field[4]);
+
+		for (act = mountwatch_list; act != NULL; act = act->next) {
+			if (strcmp(act->name, field[4]) == 0) {
+				act->parameter.mwatch.found = TRUE;
+				act->parameter.mwatch.readonly = has_ro(field[5]) || (super != NULL && has_ro(super));
+			}
+		}
+	}
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int open_mountwatch(struct list *mlist)
+{
+	struct list *act;
+
+	close_mountwatch();
+
+	if (mlist == NULL)
+		return -1;
+
+	/* The table has no trailing '/' on mount points. */
+	for (act = mlist; act != NULL; act = act->next) {
+		size_t len = strlen(act->name);
+		while (len > 1 && act->name[len - 1] == '/')
+			act->name[--len] = 0;
+	}
+
+	mi_fd = open(mi_name, O_RDONLY | O_CLOEXEC);
+	if (mi_fd == -1) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", mi_name, errno, strerror(errno));
+		return -1;
+	}
+
+	mi_size = 16384;
+	mi_buf = xmalloc(mi_size);
+
+	if (parse_mountinfo() != ENOERR || add_event_fd(mi_fd, POLLPRI, mountinfo_event, NULL, NULL) != 0) {
+		log_message(LOG_ERR, "mounts will not be watched");
+		close_mountwatch();
+		return -1;
+	}
+
+	for (act = mlist; act != NULL; act = act->next) {
+		if (verbose)
+			log_message(LOG_DEBUG, "mount %s is %s", act->name,
+				!act->parameter.mwatch.found ? "not mounted" :
+				act->parameter.mwatch.readonly ? "read-only" : "writable");
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Called from the main loop's ppoll() when the mount table changes. This only
+ * notes the new state of each mount, check_mountwatch() reports any problem
+ * against the mount's own entry so its retry and repair limits apply.
+ */
+
+static int mountinfo_event(int fd GCC_UNUSED, short revents GCC_UNUSED, void *arg GCC_UNUSED)
+{
+	if (verbose)
+		log_message(LOG_DEBUG, "mount table changed");
+
+	parse_mountinfo();
+	return (EDONTKNOW);
+}
+
+int check_mountwatch(struct list *act)
+{
+	struct mntwatch *mw = &act->parameter.mwatch;
+
+	if (mi_fd == -1)
+		return (ENOERR);
+
+	if (!mw->found) {
+		log_message(LOG_ERR, "%s is not mounted", act->name);
+		return (ENOENT);
+	}
+
+	if (mw->readonly) {
+		log_message(LOG_ERR, "%s is mounted read-only", act->name);
+		return (EROFS);
+	}
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "%s is mounted writable", act->name);
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_mountwatch(void)
+{
+	if (mi_fd != -1) {
+		remove_event_fd(mi_fd);
+		close(mi_fd);
+	}
+
+	free(mi_buf);
+	mi_fd = -1;
+	mi_buf = NULL;
+	mi_size = 0;
+	return 0;
+}
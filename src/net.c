@@ -120,7 +120,7 @@ int check_net(char *target, int sock_fp, struct sockaddr to, unsigned char *pack
 			return (err);
 		}
 
-		gettimeofday(&tstart, NULL);
+		mono_timeval(&tstart);
 		/* set the timeout value */
 		timeradd(&tstart, &tmax, &timeout);
 
@@ -128,7 +128,7 @@ int check_net(char *target, int sock_fp, struct sockaddr to, unsigned char *pack
 		FD_ZERO(&fdmask);
 		FD_SET(sock_fp, &fdmask);
 		while (1) {
-			gettimeofday(&dtimeout, NULL);
+			mono_timeval(&dtimeout);
 			timersub(&timeout, &dtimeout, &dtimeout);
 			/* Check if we have timed out waiting for a reply. */
 			if ((long)dtimeout.tv_sec < 0)
@@ -166,7 +166,7 @@ int check_net(char *target, int sock_fp, struct sockaddr to, unsigned char *pack
 							if (verbose && logtick && ticker == 1) {
 								/* Report time since tstart in milliseconds (like 'ping' program). */
 								double msec;
-								gettimeofday(&dtimeout, NULL);
+								mono_timeval(&dtimeout);
 								timersub(&dtimeout, &tstart, &dtimeout);
 								msec = 1.0e3 * (dtimeout.tv_sec + 1.0e-6 * dtimeout.tv_usec);
 								log_message(LOG_DEBUG, "got answer on ping=%d from target %-15s time=%.3fms", i+1, target, msec);
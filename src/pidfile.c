@@ -1,3 +1,29 @@
+/* > pidfile.c
+ *
+ * Code for checking that a server process, as given by its PID file, is still
+ * running.
+ *
+ * Where the kernel supports it the PID is turned in to a pidfd (Linux 5.3 and
+ * later) that is waited on in the main loop, so the process exiting is reported
+ * straight away. The PID file is watched with inotify and only read again when
+ * it changes, so while all is well no system calls are made for the check. On
+ * older kernels, or if the file can't be watched, the PID file is read and the
+ * process 'pinged' with kill(pid, 0) every interval as before.
+ *
+ * Because a PID can be re-used, when inotify sees the PID file written the time
+ * since boot is noted, and the start time of the process (also counted from boot)
+ * is checked against it: a process started after that cannot be the one that
+ * wrote it. Both are on CLOCK_BOOTTIME, so a step of the system clock doesn't
+ * matter. A PID file that was there before we started is trusted.
+ *
+ * Optionally a process can be checked more deeply, as one that is hung in an
+ * uninterruptible sleep or dead-locked still exists. For this /proc/<pid>/stat
+ * and /proc/<pid>/io are kept open and read each interval to see how long the
+ * process has been in D (disk wait) or T (stopped) state, and whether its CPU
+ * time or I/O count has moved.
+ *
+ */
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -7,33 +33,137 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wait.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
 
 #include "extern.h"
 #include "watch_err.h"
 
-int check_pidfile(struct list *file)
+/* Allow for rounding of the start time to clock ticks. */
+#define START_SLACK	2
+
+static int have_pidfd = TRUE;
+
+static int pidfd_event(int fd, short revents, void *arg);
+
+/* ============================================================================ */
+
+static int sys_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Called by fwatch.c when the PID file (or its directory entry) changes.
+ */
+
+static void pidfile_changed(void *arg, unsigned int mask GCC_UNUSED)
+{
+	struct list *file = arg;
+
+	file->parameter.pid.changed = TRUE;
+	file->parameter.pid.written = clock_ns(CLOCK_BOOTTIME) / 1000000000LL;
+}
+
+/*
+ * Set up the PID file watches, the files themselves are read on the first check.
+ */
+
+int open_pidcheck(struct list *plist)
+{
+	struct list *act;
+
+	for (act = plist; act != NULL; act = act->next) {
+		struct pidmode *pm = &act->parameter.pid;
+
+		pm->pid = 0;
+		pm->pidfd = -1;
+		pm->dead = FALSE;
+		pm->changed = TRUE;
+		pm->written = 0;
+		pm->watched = (add_file_watch(act->name, pidfile_changed, act) == 0);
+		pm->deep_pid = 0;
+		pm->stat_fd = pm->io_fd = -1;
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Return the start time of a process in seconds since boot, or -1 on error.
+ */
+
+static time_t process_start(pid_t pid)
+{
+	char name[64], buf[512], *ptr;
+	unsigned long long start = 0;
+	long hz = sysconf(_SC_CLK_TCK);
+	int fd, n, field;
+
+	snprintf(name, sizeof(name), "/proc/%d/stat", (int)pid);
+	if ((fd = open(name, O_RDONLY)) == -1)
+		return -1;
+	n = pread(fd, buf, sizeof(buf)-1, 0);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = 0;
+
+	/* The command name is in brackets and may contain spaces, so start after it. */
+	ptr = strrchr(buf, ')');
+	if (ptr == NULL)
+		return -1;
+
+	/* Field 3 is the state, we want field 22 'starttime' in clock ticks since boot. */
+	for (field = 2; field < 22 && ptr != NULL; field++)
+		ptr = strchr(ptr + 1, ' ');
+	if (ptr == NULL)
+		return -1;
+	start = strtoull(ptr + 1, NULL, 10);
+
+	return (time_t)(start / (hz > 0 ? hz : 100));
+}
+
+/*
+ * Is the process newer than the PID file? Only known if we saw the file written.
+ */
+
+static int pid_reused(struct pidmode *pm, time_t start)
 {
-	int fd = open(file->name, O_RDONLY), pid;
+	return (pm->written != 0 && start > pm->written + START_SLACK);
+}
+
+/*
+ * (Re-)read the PID file and, if we can, get a pidfd for the process and add
+ * it to the main loop's ppoll() set.
+ */
+
+static int read_pidfile(struct list *file)
+{
+	struct pidmode *pm = &file->parameter.pid;
 	char buf[20];
-	int n;
+	pid_t pid;
+	int fd, n;
 
+	fd = open(file->name, O_RDONLY);
 	if (fd == -1) {
 		int err = errno;
 		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", file->name, err, strerror(err));
 		return (err);
 	}
 
-	/* position pointer at start of file */
-	if (lseek(fd, 0, SEEK_SET) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "lseek %s gave errno = %d = '%s'", file->name, err, strerror(err));
-		close(fd);
-		return (err);
-	}
-
 	/* read the line (there is only one) */
-	if ((n = read(fd, buf, sizeof(buf)-1)) < 0) {
+	if ((n = pread(fd, buf, sizeof(buf)-1, 0)) < 0) {
 		int err = errno;
 		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", file->name, err, strerror(err));
 		close(fd);
@@ -42,24 +172,291 @@ int check_pidfile(struct list *file)
 	/* Force string to be nul-terminated. */
 	buf[n] = 0;
 
-	/* we only care about integer values */
-	pid = atoi(buf);
-
 	if (close(fd) == -1) {
 		int err = errno;
 		log_message(LOG_ERR, "could not close %s, errno = %d = '%s'", file->name, err, strerror(err));
 		return (err);
 	}
 
-	if (kill(pid, 0) == -1) {
+	/* we only care about integer values */
+	pid = atoi(buf);
+	if (pid <= 0) {
+		log_message(LOG_ERR, "%s does not contain a valid PID (read = %s)", file->name, buf);
+		return (ESRCH);
+	}
+
+	if (pid == pm->pid && pm->pidfd != -1)
+		return (ENOERR);
+
+	if (pm->pidfd != -1) {
+		remove_event_fd(pm->pidfd);
+		close(pm->pidfd);
+		pm->pidfd = -1;
+	}
+
+	pm->pid = pid;
+	pm->dead = FALSE;
+
+	if (have_pidfd && pm->watched) {
+		struct pollfd pfd;
+		time_t start;
+
+		pm->pidfd = sys_pidfd_open(pid);
+		if (pm->pidfd == -1) {
+			int err = errno;
+			if (err == ENOSYS) {
+				log_message(LOG_INFO, "pidfd not supported, checking PID files every interval");
+				have_pidfd = FALSE;
+				return (ENOERR);
+			}
+			log_message(LOG_ERR, "cannot open process %d (%s) (errno = %d = '%s')", pid, file->name, err, strerror(err));
+			pm->dead = TRUE;
+			return (err);
+		}
+
+		/*
+		 * The pidfd is for whichever process had the PID when it was opened. If that
+		 * process has not exited by the time its start time has been read, the start
+		 * time is its own, and if it started before the PID file was written it is
+		 * the one that wrote it. Any later exit is then seen on the pidfd.
+		 */
+		start = process_start(pid);
+		pfd.fd = pm->pidfd;
+		pfd.events = POLLIN;
+		if (start == -1 || poll(&pfd, 1, 0) != 0) {
+			log_message(LOG_ERR, "process %d (%s) has exited", pid, file->name);
+			pm->dead = TRUE;
+		} else if (pid_reused(pm, start)) {
+			log_message(LOG_ERR, "process %d started after %s was written, PID has been re-used", pid, file->name);
+			pm->dead = TRUE;
+		}
+
+		if (pm->dead) {
+			close(pm->pidfd);
+			pm->pidfd = -1;
+			return (ESRCH);
+		}
+
+		add_event_fd(pm->pidfd, POLLIN, pidfd_event, file, file);
+	} else if (pm->written != 0) {
+		/* Without a pidfd the PID could still be re-used after this, but check anyway. */
+		time_t start = process_start(pid);
+
+		if (start != -1 && pid_reused(pm, start)) {
+			log_message(LOG_ERR, "process %d started after %s was written, PID has been re-used", pid, file->name);
+			pm->dead = TRUE;
+			return (ESRCH);
+		}
+	}
+
+	return (ENOERR);
+}
+
+/*
+ * Called from the main loop's ppoll() when a monitored process exits.
+ */
+
+static int pidfd_event(int fd, short revents GCC_UNUSED, void *arg)
+{
+	struct list *file = arg;
+	struct pidmode *pm = &file->parameter.pid;
+
+	remove_event_fd(fd);
+	close(fd);
+	pm->pidfd = -1;
+	pm->dead = TRUE;
+
+	log_message(LOG_ERR, "process %d (%s) has exited", pm->pid, file->name);
+	return (ESRCH);
+}
+
+/* ============================================================================ */
+
+static void close_deep(struct pidmode *pm)
+{
+	if (pm->stat_fd != -1)
+		close(pm->stat_fd);
+	if (pm->io_fd != -1)
+		close(pm->io_fd);
+	pm->stat_fd = pm->io_fd = -1;
+	pm->deep_pid = 0;
+}
+
+/*
+ * Sum of the "rchar:" and "wchar:" counts from /proc/<pid>/io, this includes all
+ * read() and write() calls so covers network as well as disk I/O.
+ */
+
+static unsigned long long io_count(int fd)
+{
+	char buf[512], *ptr;
+	unsigned long long total = 0;
+	int n;
+
+	if ((n = pread(fd, buf, sizeof(buf)-1, 0)) <= 0)
+		return 0;
+	buf[n] = 0;
+
+	if ((ptr = strstr(buf, "rchar:")) != NULL)
+		total += strtoull(ptr + 6, NULL, 10);
+	if ((ptr = strstr(buf, "wchar:")) != NULL)
+		total += strtoull(ptr + 6, NULL, 10);
+
+	return total;
+}
+
+static int check_progress(struct list *file)
+{
+	struct pidmode *pm = &file->parameter.pid;
+	char buf[512], *ptr, state;
+	unsigned long long utime, stime, work;
+	time_t now;
+	int n, field;
+
+	if (pm->stuck <= 0 && pm->progress <= 0)
+		return (ENOERR);
+
+	now = mono_seconds();
+
+	if (pm->deep_pid != pm->pid) {
+		close_deep(pm);
+
+		snprintf(buf, sizeof(buf), "/proc/%d/stat", (int)pm->pid);
+		if ((pm->stat_fd = open(buf, O_RDONLY | O_CLOEXEC)) == -1) {
+			int err = errno;
+			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", buf, err, strerror(err));
+			return (err);
+		}
+
+		/* Not readable on some kernels, so just use the CPU time if it fails. */
+		snprintf(buf, sizeof(buf), "/proc/%d/io", (int)pm->pid);
+		pm->io_fd = open(buf, O_RDONLY | O_CLOEXEC);
+
+		pm->deep_pid = pm->pid;
+		pm->state_since = 0;
+		pm->work_since = 0;
+	}
+
+	if ((n = pread(pm->stat_fd, buf, sizeof(buf)-1, 0)) <= 0) {
+		int err = (n == 0) ? ESRCH : errno;
+		log_message(LOG_ERR, "cannot read status of process %d (%s) (errno = %d = '%s')",
+			pm->pid, file->name, err, strerror(err));
+		close_deep(pm);
+		return (err);
+	}
+	buf[n] = 0;
+
+	/* Skip the command name as it may contain spaces, then get fields 3, 14 & 15. */
+	if ((ptr = strrchr(buf, ')')) == NULL || ptr[1] != ' ') {
+		log_message(LOG_ERR, "status of process %d (%s) contains invalid data", pm->pid, file->name);
+		return (EDONTKNOW);
+	}
+	state = ptr[2];
+	for (field = 2; field < 14 && ptr != NULL; field++)
+		ptr = strchr(ptr + 1, ' ');
+	if (ptr == NULL) {
+		log_message(LOG_ERR, "status of process %d (%s) contains invalid data", pm->pid, file->name);
+		return (EDONTKNOW);
+	}
+	utime = strtoull(ptr + 1, &ptr, 10);
+	stime = strtoull(ptr, NULL, 10);
+
+	if (state == 'Z' || state == 'X') {
+		log_message(LOG_ERR, "process %d (%s) is a zombie", pm->pid, file->name);
+		return (ESRCH);
+	}
+
+	if (state == 'D' || state == 'T' || state == 't') {
+		if (pm->state_since == 0)
+			pm->state_since = now;
+		if (pm->stuck > 0 && now - pm->state_since >= pm->stuck) {
+			log_message(LOG_ERR, "process %d (%s) has been in state %c for %ld seconds",
+				pm->pid, file->name, state, (long)(now - pm->state_since));
+			return (ENOPROGRESS);
+		}
+	} else {
+		pm->state_since = 0;
+	}
+
+	work = utime + stime;
+	if (pm->io_fd != -1)
+		work += io_count(pm->io_fd);
+
+	if (pm->work_since == 0 || work != pm->work) {
+		pm->work = work;
+		pm->work_since = now;
+	} else if (pm->progress > 0 && now - pm->work_since >= pm->progress) {
+		log_message(LOG_ERR, "process %d (%s) has used no CPU time and done no I/O for %ld seconds",
+			pm->pid, file->name, (long)(now - pm->work_since));
+		return (ENOPROGRESS);
+	}
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "process %d (%s) state %c, %llu CPU ticks", pm->pid, file->name, state, utime + stime);
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int check_pidfile(struct list *file)
+{
+	struct pidmode *pm = &file->parameter.pid;
+
+	if (pm->changed || !pm->watched) {
+		int err;
+
+		if (pm->watched)
+			pm->changed = FALSE;
+
+		if ((err = read_pidfile(file)) != ENOERR) {
+			/* Try again next time in case it was caught part-written. */
+			pm->changed = TRUE;
+			return (err);
+		}
+	}
+
+	if (pm->dead) {
+		log_message(LOG_ERR, "process %d (%s) is not running", pm->pid, file->name);
+		return (ESRCH);
+	}
+
+	if (pm->pidfd != -1) {
+		/* Process exit is reported by pidfd_event(), so nothing to do. */
+		if (verbose && logtick && ticker == 1)
+			log_message(LOG_DEBUG, "process %d (%s) is running", pm->pid, file->name);
+		return check_progress(file);
+	}
+
+	if (kill(pm->pid, 0) == -1) {
 		int err = errno;
-		log_message(LOG_ERR, "pinging process %d (%s) gave errno = %d = '%s'", pid, file->name, err, strerror(err));
+		log_message(LOG_ERR, "pinging process %d (%s) gave errno = %d = '%s'", pm->pid, file->name, err, strerror(err));
 		return (err);
 	}
 
 	/* do verbose logging */
 	if (verbose && logtick && ticker == 1)
-		log_message(LOG_DEBUG, "was able to ping process %d (%s)", pid, file->name);
+		log_message(LOG_DEBUG, "was able to ping process %d (%s)", pm->pid, file->name);
 
-	return (ENOERR);
+	return check_progress(file);
+}
+
+/* ============================================================================ */
+
+int close_pidcheck(void)
+{
+	struct list *act;
+
+	for (act = pidfile_list; act != NULL; act = act->next) {
+		struct pidmode *pm = &act->parameter.pid;
+
+		if (pm->pidfd != -1) {
+			remove_event_fd(pm->pidfd);
+			close(pm->pidfd);
+		}
+		pm->pidfd = -1;
+		close_deep(pm);
+	}
+
+	return 0;
 }
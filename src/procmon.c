@@ -0,0 +1,435 @@
+/* > procmon.c
+ *
+ * Code for checking that a process of a given name is running, for servers
+ * that don't write a PID file. The name is either the command name as shown
+ * by 'ps -o comm' or, if it starts with '/', the full path of the executable.
+ *
+ * Rather than scanning /proc every interval (as running 'pgrep' from a test
+ * binary does) /proc is scanned once at start-up and after that the kernel's
+ * process connector tells us about every fork(), exec() and exit(). A table of
+ * the PIDs running each configured name is kept up to date from those events,
+ * so the check itself is just looking at a count.
+ *
+ * The process connector needs CAP_NET_ADMIN. If it can't be used, or if we miss
+ * events because the socket buffer overflowed, /proc is scanned again.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+/* Length of a command name, including the nul, as the kernel's TASK_COMM_LEN */
+#define COMM_LEN	16
+
+/* PID -> configured entry it matches, open addressing with linear probing. */
+struct pidslot {
+	pid_t pid;					/* 0 if slot free */
+	struct list *act;
+};
+
+static struct list *plist = NULL;
+static struct pidslot *ptable = NULL;
+static unsigned int psize = 0;		/* always a power of 2 */
+static unsigned int pused = 0;
+static int nl_fd = -1;
+static int need_scan = TRUE;
+static int want_exe = FALSE;		/* any name given as a path */
+
+static int procmon_event(int fd, short revents, void *arg);
+
+/* ============================================================================ */
+
+static unsigned int pid_hash(pid_t pid)
+{
+	return ((unsigned int)pid * 2654435761U) & (psize - 1);
+}
+
+static struct pidslot *pid_find(pid_t pid)
+{
+	unsigned int ii;
+
+	for (ii = pid_hash(pid); ptable[ii].pid != 0; ii = (ii + 1) & (psize - 1)) {
+		if (ptable[ii].pid == pid)
+			return &ptable[ii];
+	}
+
+	return NULL;
+}
+
+static void pid_insert(pid_t pid, struct list *act);
+
+static void pid_grow(void)
+{
+	struct pidslot *old = ptable;
+	unsigned int ii, oldsize = psize;
+
+	psize = oldsize ? 2 * oldsize : 64;
+	ptable = xcalloc(psize, sizeof(struct pidslot));
+	pused = 0;
+
+	for (ii = 0; ii < oldsize; ii++) {
+		if (old[ii].pid != 0)
+			pid_insert(old[ii].pid, old[ii].act);
+	}
+
+	free(old);
+}
+
+static void pid_insert(pid_t pid, struct list *act)
+{
+	unsigned int ii;
+
+	if (2 * (pused + 1) > psize)
+		pid_grow();
+
+	for (ii = pid_hash(pid); ptable[ii].pid != 0; ii = (ii + 1) & (psize - 1)) {
+		if (ptable[ii].pid == pid)
+			return;
+	}
+
+	ptable[ii].pid = pid;
+	ptable[ii].act = act;
+	pused++;
+	act->parameter.proc.count++;
+}
+
+/*
+ * Remove a PID, moving back any later entries in the same run so that no
+ * 'deleted' markers are needed.
+ */
+
+static void pid_remove(pid_t pid)
+{
+	struct pidslot *slot;
+	unsigned int ii, jj;
+
+	if (psize == 0 || (slot = pid_find(pid)) == NULL)
+		return;
+
+	slot->act->parameter.proc.count--;
+	pused--;
+
+	ii = slot - ptable;
+	for (jj = (ii + 1) & (psize - 1); ptable[jj].pid != 0; jj = (jj + 1) & (psize - 1)) {
+		unsigned int home = pid_hash(ptable[jj].pid);
+
+		/* Can the entry at jj be moved back to the gap at ii? */
+		if (((jj - home) & (psize - 1)) >= ((jj - ii) & (psize - 1))) {
+			ptable[ii] = ptable[jj];
+			ii = jj;
+		}
+	}
+
+	ptable[ii].pid = 0;
+	ptable[ii].act = NULL;
+}
+
+static void pid_clear(void)
+{
+	struct list *act;
+
+	if (ptable != NULL)
+		memset(ptable, 0, psize * sizeof(struct pidslot));
+	pused = 0;
+
+	for (act = plist; act != NULL; act = act->next)
+		act->parameter.proc.count = 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Find which configured entry (if any) process 'pid' matches.
+ */
+
+static struct list *match_process(pid_t pid)
+{
+	char name[64], comm[COMM_LEN + 1], exe[PATH_MAX];
+	struct list *act;
+	int fd, n, have_exe = FALSE;
+
+	snprintf(name, sizeof(name), "/proc/%d/comm", (int)pid);
+	if ((fd = open(name, O_RDONLY)) == -1)
+		return NULL;
+	n = read(fd, comm, sizeof(comm) - 1);
+	close(fd);
+	if (n <= 0)
+		return NULL;
+	if (comm[n - 1] == '\n')
+		n--;
+	comm[n] = 0;
+
+	if (want_exe) {
+		snprintf(name, sizeof(name), "/proc/%d/exe", (int)pid);
+		n = readlink(name, exe, sizeof(exe) - 1);
+		if (n > 0) {
+			exe[n] = 0;
+			have_exe = TRUE;
+		}
+	}
+
+	for (act = plist; act != NULL; act = act->next) {
+		if (act->name[0] == '/') {
+			if (have_exe && strcmp(act->name, exe) == 0)
+				return act;
+		} else if (strncmp(act->name, comm, COMM_LEN - 1) == 0) {
+			/* The kernel truncates the command name, so allow for that. */
+			return act;
+		}
+	}
+
+	return NULL;
+}
+
+static void update_process(pid_t pid)
+{
+	struct list *act;
+
+	pid_remove(pid);
+	if ((act = match_process(pid)) != NULL)
+		pid_insert(pid, act);
+}
+
+/*
+ * Build the table from scratch. Done at start-up and whenever we might have
+ * missed events.
+ */
+
+static int scan_processes(void)
+{
+	struct dirent *ent;
+	DIR *dir;
+
+	dir = opendir("/proc");
+	if (dir == NULL) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot open /proc (errno = %d = '%s')", err, strerror(err));
+		return (err);
+	}
+
+	pid_clear();
+
+	while ((ent = readdir(dir)) != NULL) {
+		pid_t pid;
+		struct list *act;
+
+		if (ent->d_name[0] < '1' || ent->d_name[0] > '9')
+			continue;
+
+		pid = atoi(ent->d_name);
+		if ((act = match_process(pid)) != NULL)
+			pid_insert(pid, act);
+	}
+
+	closedir(dir);
+	need_scan = FALSE;
+
+	if (verbose)
+		log_message(LOG_DEBUG, "scanned /proc, %u matching process(es)", pused);
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+static int proc_connector(int op)
+{
+	struct {
+		struct nlmsghdr nl;
+		struct cn_msg cn;
+		enum proc_cn_mcast_op op;
+	} __attribute__ ((packed)) msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.nl.nlmsg_len = sizeof(msg);
+	msg.nl.nlmsg_type = NLMSG_DONE;
+	msg.nl.nlmsg_pid = getpid();
+	msg.cn.id.idx = CN_IDX_PROC;
+	msg.cn.id.val = CN_VAL_PROC;
+	msg.cn.len = sizeof(enum proc_cn_mcast_op);
+	msg.op = op;
+
+	return (send(nl_fd, &msg, sizeof(msg), 0) == sizeof(msg)) ? 0 : -1;
+}
+
+int open_proccheck(struct list *list)
+{
+	struct sockaddr_nl addr;
+	struct list *act;
+
+	close_proccheck();
+
+	plist = list;
+	if (plist == NULL)
+		return -1;
+
+	for (act = plist; act != NULL; act = act->next) {
+		act->parameter.proc.count = 0;
+		if (act->name[0] == '/')
+			want_exe = TRUE;
+	}
+
+	pid_grow();
+	need_scan = TRUE;
+
+	nl_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (nl_fd == -1)
+		goto fail;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = getpid();
+
+	if (bind(nl_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || proc_connector(PROC_CN_MCAST_LISTEN) == -1)
+		goto fail;
+
+	if (add_event_fd(nl_fd, POLLIN, procmon_event, NULL, NULL) != 0)
+		goto fail;
+
+	/* Subscribed before the scan so nothing can be missed in between. */
+	scan_processes();
+	return 0;
+
+fail:
+	log_message(LOG_WARNING, "cannot use process connector, scanning /proc every interval (errno = %d = '%s')",
+		errno, strerror(errno));
+	if (nl_fd != -1)
+		close(nl_fd);
+	nl_fd = -1;
+	return -1;
+}
+
+/* ============================================================================ */
+
+/*
+ * Read all waiting process events and update the table. Problems are reported
+ * by check_process(), so nothing is returned here.
+ */
+
+static int procmon_event(int fd, short revents GCC_UNUSED, void *arg GCC_UNUSED)
+{
+	char buf[8192] __attribute__ ((aligned(NLMSG_ALIGNTO)));
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf), 0)) != 0) {
+		struct nlmsghdr *nlh;
+
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				/* Events were dropped, so the table can't be trusted. */
+				log_message(LOG_WARNING, "process connector overflow, scanning /proc again");
+				need_scan = TRUE;
+				continue;
+			}
+			break;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			struct cn_msg *cn;
+			struct proc_event *ev;
+
+			if (nlh->nlmsg_type == NLMSG_NOOP || nlh->nlmsg_type == NLMSG_ERROR)
+				continue;
+
+			cn = NLMSG_DATA(nlh);
+			if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+				continue;
+
+			ev = (struct proc_event *)cn->data;
+			switch (ev->what) {
+			case PROC_EVENT_FORK:
+				/* A new process (not thread) starts with its parent's name. */
+				if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid) {
+					struct pidslot *slot = pid_find(ev->event_data.fork.parent_tgid);
+					if (slot != NULL)
+						pid_insert(ev->event_data.fork.child_tgid, slot->act);
+				}
+				break;
+
+			case PROC_EVENT_EXEC:
+				update_process(ev->event_data.exec.process_tgid);
+				break;
+
+			case PROC_EVENT_COMM:
+				if (ev->event_data.comm.process_pid == ev->event_data.comm.process_tgid)
+					update_process(ev->event_data.comm.process_tgid);
+				break;
+
+			case PROC_EVENT_EXIT:
+				if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+					pid_remove(ev->event_data.exit.process_tgid);
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+
+	if (need_scan)
+		scan_processes();
+
+	return (EDONTKNOW);
+}
+
+/* ============================================================================ */
+
+int check_process(struct list *act)
+{
+	/* Without the connector the table is rebuilt once per interval. */
+	if (nl_fd == -1 && act == plist)
+		need_scan = TRUE;
+
+	if (need_scan) {
+		int err = scan_processes();
+		if (err != ENOERR)
+			return (err);
+	}
+
+	if (act->parameter.proc.count == 0) {
+		log_message(LOG_ERR, "no process '%s' is running", act->name);
+		return (ESRCH);
+	}
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "%d process(es) '%s' running", act->parameter.proc.count, act->name);
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_proccheck(void)
+{
+	if (nl_fd != -1) {
+		proc_connector(PROC_CN_MCAST_IGNORE);
+		remove_event_fd(nl_fd);
+		close(nl_fd);
+	}
+
+	free(ptable);
+	ptable = NULL;
+	psize = pused = 0;
+	nl_fd = -1;
+	plist = NULL;
+	want_exe = FALSE;
+	return 0;
+}
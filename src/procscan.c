@@ -0,0 +1,482 @@
+/* > procscan.c
+ *
+ * Code for finding tasks stuck in uninterruptible sleep (D state) anywhere on
+ * the system, much like the kernel's own hung-task detector which is often not
+ * enabled. A pile-up of D state tasks, for example behind a dead NFS server or
+ * a failing disk, can leave a machine useless while the daemon still runs.
+ *
+ * The scan has to cope with a very large number of tasks without making the
+ * main loop late, so each pass works like this:
+ *
+ *  - The /proc directory (kept open) is read with getdents64() a buffer at a
+ *    time, as the scan gets to it, so neither the time taken nor the memory
+ *    used in one interval grows with the number of processes.
+ *
+ *  - Each interval at most 'proc-scan-max' stat files are read, relative to
+ *    the /proc descriptor. For a process with more than one thread that is
+ *    followed by <pid>/task/<tid>/stat for each thread, as it is often a worker
+ *    thread that is stuck. A long thread list is also read a part at a time.
+ *
+ *  - Tasks in D state are kept in a small hash table keyed on PID and start
+ *    time (so a re-used PID is not mistaken for the old task) holding when
+ *    the task was first seen in D state.
+ *
+ * When a pass is complete the counts are updated, entries for tasks no longer
+ * in D state are dropped, and the next pass starts. The result of the last full
+ * pass is reported every interval.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define PROC_BUF	(32 * 1024)		/* getdents64() buffer for /proc */
+#define TASK_BUF	(8 * 1024)		/* and for a task directory */
+
+struct linux_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* A directory being read a buffer at a time. */
+struct dirscan {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t used;
+	size_t cursor;				/* next entry to look at */
+};
+
+/* One task seen in D state. */
+struct dtask {
+	pid_t pid;					/* 0 if slot free */
+	unsigned int gen;			/* pass it was last seen in D state */
+	unsigned long long start;	/* start time in ticks since boot */
+	time_t since;				/* monotonic time first seen in D state */
+};
+
+static struct dirscan procdir = { -1, NULL, 0, 0, 0 };
+static struct dirscan taskdir = { -1, NULL, 0, 0, 0 };	/* of a process with threads */
+static int pass_active = FALSE;
+static unsigned int gen = 1;
+
+static struct dtask *dtab[2] = { NULL, NULL };
+static unsigned int dsize = 0;		/* always a power of 2 */
+static unsigned int dused = 0;
+static int dcur = 0;
+
+/* Counts for the pass in progress, and the last complete one. */
+static unsigned int n_dstate, n_hung, n_zombie, n_tasks;
+static time_t worst;
+static pid_t worst_pid;
+
+static struct {
+	int valid;
+	unsigned int tasks, dstate, hung, zombies;
+	time_t worst;
+	pid_t worst_pid;
+} last;
+
+/* ============================================================================ */
+
+int open_procscan(void)
+{
+	close_procscan();
+
+	if (hung_timeout <= 0 && maxdstate <= 0 && maxzombieuse <= 0)
+		return -1;
+
+	if (proc_scan_max <= 0)
+		proc_scan_max = 5000;
+
+	procdir.fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (procdir.fd == -1) {
+		log_message(LOG_ERR, "cannot open /proc (errno = %d = '%s')", errno, strerror(errno));
+		return -1;
+	}
+
+	procdir.size = PROC_BUF;
+	procdir.buf = xcalloc(1, procdir.size);
+	taskdir.size = TASK_BUF;
+	taskdir.buf = xcalloc(1, taskdir.size);
+
+	dsize = 256;
+	dtab[0] = xcalloc(dsize, sizeof(struct dtask));
+	dtab[1] = xcalloc(dsize, sizeof(struct dtask));
+	dcur = 0;
+
+	memset(&last, 0, sizeof(last));
+	pass_active = FALSE;
+	return 0;
+}
+
+/* ============================================================================ */
+
+static unsigned int dhash(pid_t pid, unsigned long long start)
+{
+	return (((unsigned int)pid ^ (unsigned int)start) * 2654435761U) & (dsize - 1);
+}
+
+static struct dtask *dtask_slot(struct dtask *tab, pid_t pid, unsigned long long start)
+{
+	unsigned int ii;
+
+	for (ii = dhash(pid, start); tab[ii].pid != 0; ii = (ii + 1) & (dsize - 1)) {
+		if (tab[ii].pid == pid && tab[ii].start == start)
+			break;
+	}
+
+	return &tab[ii];
+}
+
+/*
+ * Copy the entries still wanted to the other table and switch to it, growing
+ * the tables if need be. At the end of a pass only the tasks seen in D state
+ * during it are kept, part way through (when the table fills) those from the
+ * last pass that have not been looked at yet are kept as well.
+ */
+
+static void dtask_sweep(unsigned int need, int keep_last)
+{
+	struct dtask *old = dtab[dcur];
+	struct dtask *new;
+	unsigned int ii, oldsize = dsize;
+
+	while (2 * need > dsize)
+		dsize *= 2;
+
+	if (dsize != oldsize) {
+		free(dtab[dcur ^ 1]);
+		dtab[dcur ^ 1] = xcalloc(dsize, sizeof(struct dtask));
+	} else {
+		memset(dtab[dcur ^ 1], 0, dsize * sizeof(struct dtask));
+	}
+
+	new = dtab[dcur ^ 1];
+	dused = 0;
+	for (ii = 0; ii < oldsize; ii++) {
+		if (old[ii].pid != 0 && (old[ii].gen == gen || (keep_last && old[ii].gen == gen - 1))) {
+			*dtask_slot(new, old[ii].pid, old[ii].start) = old[ii];
+			dused++;
+		}
+	}
+
+	if (dsize != oldsize) {
+		free(old);
+		dtab[dcur] = xcalloc(dsize, sizeof(struct dtask));
+	}
+
+	dcur ^= 1;
+}
+
+/* ============================================================================ */
+
+/*
+ * Return the next entry of a directory, reading more of it when the buffer has
+ * been used up. Returns NULL with 'err' set to 0 at the end of the directory.
+ */
+
+static struct linux_dirent64 *next_entry(struct dirscan *ds, int *err)
+{
+	struct linux_dirent64 *de;
+
+	*err = 0;
+
+	if (ds->cursor >= ds->used) {
+		long n = syscall(SYS_getdents64, ds->fd, ds->buf, ds->size);
+
+		if (n <= 0) {
+			*err = (n < 0) ? errno : 0;
+			return NULL;
+		}
+		ds->used = n;
+		ds->cursor = 0;
+	}
+
+	de = (struct linux_dirent64 *)(ds->buf + ds->cursor);
+	ds->cursor += de->d_reclen;
+	return de;
+}
+
+static void close_taskdir(void)
+{
+	if (taskdir.fd != -1)
+		close(taskdir.fd);
+	taskdir.fd = -1;
+}
+
+static int start_pass(void)
+{
+	if (lseek(procdir.fd, 0, SEEK_SET) == -1)
+		return errno;
+
+	procdir.used = procdir.cursor = 0;
+	close_taskdir();
+
+	n_dstate = n_hung = n_zombie = n_tasks = 0;
+	worst = 0;
+	worst_pid = 0;
+	gen++;
+	pass_active = TRUE;
+	return 0;
+}
+
+/*
+ * Read the state, number of threads and start time (in ticks since boot) from
+ * the stat file 'path' in directory 'dirfd'.
+ */
+
+static int read_stat(int dirfd, const char *path, char *state, long *threads, unsigned long long *start)
+{
+	char buf[512], *ptr;
+	int fd, n, field;
+
+	if ((fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	n = pread(fd, buf, sizeof(buf)-1, 0);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = 0;
+
+	/* Skip the command name as it may contain spaces, field 3 is the state. */
+	if ((ptr = strrchr(buf, ')')) == NULL || ptr[1] != ' ')
+		return -1;
+	*state = ptr[2];
+
+	/* Field 20 is the number of threads, and 22 the start time. */
+	*threads = 1;
+	for (field = 2; field < 22 && ptr != NULL; field++) {
+		ptr = strchr(ptr + 1, ' ');
+		if (field == 19 && ptr != NULL)
+			*threads = strtol(ptr + 1, NULL, 10);
+	}
+	*start = (ptr != NULL) ? strtoull(ptr + 1, NULL, 10) : 0;
+
+	return 0;
+}
+
+/*
+ * Count one task, and note how long it has been in D state if it is.
+ */
+
+static void count_task(pid_t pid, char state, unsigned long long start, time_t now)
+{
+	struct dtask *dt;
+
+	n_tasks++;
+
+	if (state != 'D')
+		return;
+
+	n_dstate++;
+
+	if (2 * (dused + 1) > dsize)
+		dtask_sweep(dused + 1, TRUE);
+
+	dt = dtask_slot(dtab[dcur], pid, start);
+	if (dt->pid == 0) {
+		dt->pid = pid;
+		dt->start = start;
+		dt->since = now;
+		dused++;
+	}
+	dt->gen = gen;
+
+	if (now - dt->since >= worst) {
+		worst = now - dt->since;
+		worst_pid = dt->pid;
+	}
+
+	if (hung_timeout > 0 && now - dt->since >= hung_timeout)
+		n_hung++;
+}
+
+/*
+ * Look at one process, 'name' is its /proc directory. If it has more than one
+ * thread its task directory is opened, and the threads looked at from there.
+ */
+
+static void scan_process(const char *name, time_t now)
+{
+	char path[32], state;
+	unsigned long long start;
+	long threads;
+
+	snprintf(path, sizeof(path), "%s/stat", name);
+	if (read_stat(procdir.fd, path, &state, &threads, &start) != 0)
+		return;
+
+	if (state == 'Z') {
+		n_tasks++;
+		n_zombie++;
+		return;
+	}
+
+	if (threads > 1) {
+		snprintf(path, sizeof(path), "%s/task", name);
+		taskdir.fd = openat(procdir.fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (taskdir.fd != -1) {
+			taskdir.used = taskdir.cursor = 0;
+			return;
+		}
+	}
+
+	count_task(atoi(name), state, start, now);
+}
+
+/* Look at one thread, 'name' is its directory under the task directory. */
+static void scan_thread(const char *name, time_t now)
+{
+	char path[32], state;
+	unsigned long long start;
+	long threads;
+
+	snprintf(path, sizeof(path), "%s/stat", name);
+	if (read_stat(taskdir.fd, path, &state, &threads, &start) == 0)
+		count_task(atoi(name), state, start, now);
+}
+
+static void end_pass(void)
+{
+	last.valid = TRUE;
+	last.tasks = n_tasks;
+	last.dstate = n_dstate;
+	last.hung = n_hung;
+	last.zombies = n_zombie;
+	last.worst = worst;
+	last.worst_pid = worst_pid;
+
+	/* Drop tasks that are no longer in D state (or have gone). */
+	dtask_sweep(dused, FALSE);
+	pass_active = FALSE;
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "scanned %u tasks, %u in D state (longest %ld seconds), %u zombie(s)",
+			n_tasks, n_dstate, (long)worst, n_zombie);
+}
+
+/* ============================================================================ */
+
+/*
+ * Do the next part of the scan. This only returns an error code for the
+ * scan failing, the checks on the results are in check_hungtask().
+ */
+
+int update_procscan(void)
+{
+	time_t now;
+	int done = 0;
+
+	if (procdir.fd == -1)
+		return (ENOERR);
+
+	if (!pass_active) {
+		int err = start_pass();
+		if (err != 0) {
+			log_message(LOG_ERR, "cannot read /proc (errno = %d = '%s')", err, strerror(err));
+			return (err);
+		}
+	}
+
+	now = mono_seconds();
+
+	while (done < proc_scan_max) {
+		struct linux_dirent64 *de;
+		int err;
+
+		if (taskdir.fd != -1) {
+			/* An error here is most likely the process having gone, so just move on. */
+			if ((de = next_entry(&taskdir, &err)) == NULL) {
+				close_taskdir();
+			} else if (de->d_name[0] >= '1' && de->d_name[0] <= '9') {
+				scan_thread(de->d_name, now);
+				done++;
+			}
+			continue;
+		}
+
+		if ((de = next_entry(&procdir, &err)) == NULL) {
+			if (err != 0) {
+				log_message(LOG_ERR, "cannot read /proc (errno = %d = '%s')", err, strerror(err));
+				pass_active = FALSE;
+				return (err);
+			}
+			end_pass();
+			break;
+		}
+
+		if (de->d_name[0] >= '1' && de->d_name[0] <= '9') {
+			scan_process(de->d_name, now);
+			done++;
+		}
+	}
+
+	return (ENOERR);
+}
+
+/*
+ * Number of zombies found by the last full pass, returns FALSE if not known.
+ */
+
+int procscan_zombies(unsigned int *count)
+{
+	*count = last.zombies;
+	return last.valid;
+}
+
+int check_hungtask(void)
+{
+	if (!last.valid)
+		return (ENOERR);
+
+	if (hung_timeout > 0 && last.hung > maxhung) {
+		log_message(LOG_ERR, "%u task(s) in D state for more than %d seconds (longest PID %d for %ld seconds)",
+			last.hung, hung_timeout, (int)last.worst_pid, (long)last.worst);
+		return (EHUNGTASK);
+	}
+
+	if (maxdstate > 0 && last.dstate > maxdstate) {
+		log_message(LOG_ERR, "%u tasks in D state is more than %d", last.dstate, maxdstate);
+		return (EHUNGTASK);
+	}
+
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_procscan(void)
+{
+	close_taskdir();
+	if (procdir.fd != -1)
+		close(procdir.fd);
+
+	free(procdir.buf);
+	free(taskdir.buf);
+	free(dtab[0]);
+	free(dtab[1]);
+
+	procdir.fd = -1;
+	procdir.buf = taskdir.buf = NULL;
+	procdir.used = procdir.cursor = 0;
+	dtab[0] = dtab[1] = NULL;
+	dsize = dused = 0;
+	pass_active = FALSE;
+	return 0;
+}
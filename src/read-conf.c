@@ -138,6 +138,51 @@ int read_int_func(char *arg, char *val, const char *name, int imin, int imax, in
 	return rv;
 }
 
+/*
+ * Similar to read_int_func() above, but reads a non-negative decimal number such as
+ * "1.5" in to a fixed-point integer scaled by 'scale' (a power of 10), so with a
+ * scale of 100 we get 150. Any digits beyond the scale's resolution are ignored.
+ *
+ * The return value is 0 if arg=name
+ */
+
+int read_fixed_func(char *arg, char *val, const char *name, int scale, int *iv)
+{
+	int rv = -1;		/* Assume wrong/error case. */
+
+	if (strcmp(arg, name) == 0) {
+		rv = 0;
+
+		if (val != NULL && (isdigit(*val) || *val == '.')) {
+			int ii = 0, frac = 0, div = 1;
+			char *p = val;
+
+			while (isdigit(*p))
+				ii = ii * 10 + (*p++ - '0');
+
+			if (*p == '.') {
+				for (p++; isdigit(*p); p++) {
+					if (div < scale) {
+						frac = frac * 10 + (*p - '0');
+						div *= 10;
+					}
+				}
+			}
+
+			if (*p != 0) {
+				log_message(LOG_WARNING, "Warning: trailing characters in number for '%s' (%s)", arg, val);
+			}
+
+			*iv = ii * scale + frac * (scale / div);
+			if (verbose) log_message(LOG_DEBUG, "Number '%s' found = %d/%d", arg, *iv, scale);
+		} else {
+			log_message(LOG_WARNING, "Warning: number expected for '%s'", arg);
+		}
+	}
+
+	return rv;
+}
+
 /*
  * Similar to read_int_func() above, here we search for a string. However, in this
  * case we may allow a blank case to set the string to NULL. So we use it like:
@@ -69,7 +69,27 @@ static void close_all(void)
 	close_watchdog();
 	close_loadcheck();
 	close_memcheck();
+	close_snapshot();
+	close_cpustat();
+	close_latency();
+	close_procscan();
+	close_headroom();
 	close_tempcheck();
+	close_filecheck();
+	close_mountcheck();
+	close_fscheck();
+	close_mountwatch();
+	close_kmsg();
+	close_hwerror();
+	close_mdcheck();
+	close_timecheck();
+	close_diskprobe();
+	close_diskstats();
+	close_pidcheck();
+	close_proccheck();
+	close_cgroupcheck();
+	close_file_watches();
+	close_events();
 	close_heartbeat();
 	free_process();		/* What check_bin() was waiting to report. */
 }
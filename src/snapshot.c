@@ -0,0 +1,415 @@
+/* > snapshot.c
+ *
+ * Code for taking a once-per-interval snapshot of the basic system statistics
+ * (load averages, free memory & swap, number of tasks) that are then shared by
+ * the load and memory checks, rather than each of them reading and parsing its
+ * own /proc file.
+ *
+ * The sysinfo(2) call returns all of these in one system call with no text to
+ * parse, so that is used by default. Should it fail at start-up the older method
+ * of reading /proc/loadavg and /proc/meminfo is used instead.
+ *
+ * The number of on-line CPUs (for the per-CPU load limits) and /proc/stat (for
+ * the counts of running & blocked tasks, and the per-CPU times used by cpustat.c)
+ * are only read if a check needs them.
+ * Both are read every interval through file descriptors kept open, so CPU
+ * hot-plug is picked up without any special handling.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define FREEMEM		"MemFree:"
+#define FREESWAP	"SwapFree:"
+
+struct snapshot sys_snap;
+
+static int snap_in_use = FALSE;
+static int use_sysinfo = FALSE;
+
+static int load_fd = -1;
+static const char load_name[] = "/proc/loadavg";
+static int mem_fd = -1;
+static const char mem_name[] = "/proc/meminfo";
+static int cpu_fd = -1;
+static const char cpu_name[] = "/sys/devices/system/cpu/online";
+static int stat_fd = -1;
+static const char stat_name[] = "/proc/stat";
+
+/* /proc/stat has a line per CPU (and a long interrupt line) so size is grown as needed. */
+static char *stat_buf = NULL;
+static size_t stat_size = 0;
+
+static int read_text(int fd, const char *name, char *buf, size_t len);
+static int parse_loadavg(void);
+static int parse_meminfo(void);
+static int read_online_cpus(void);
+static int read_proc_stat(void);
+
+/* ============================================================================ */
+
+/*
+ * Decide if any check needs the snapshot and, if so, how we are going to get it.
+ */
+
+int open_snapshot(void)
+{
+	struct sysinfo si;
+	int rv = 0;
+
+	close_snapshot();
+
+	if (maxload1 || maxload5 || maxload15 || minpages > 0)
+		snap_in_use = TRUE;
+
+	if (maxload1_cpu || maxload5_cpu || maxload15_cpu) {
+		snap_in_use = TRUE;
+		cpu_fd = open(cpu_name, O_RDONLY);
+		if (cpu_fd == -1) {
+			log_message(LOG_WARNING, "cannot open %s (errno = %d = '%s'), using sysconf()",
+				cpu_name, errno, strerror(errno));
+		}
+	}
+
+	if (maxrunning > 0 || maxblocked > 0 ||
+		maxsteal > 0 || maxiowait > 0 || maxirq > 0 || maxsoftirq > 0) {
+		snap_in_use = TRUE;
+		stat_fd = open(stat_name, O_RDONLY);
+		if (stat_fd == -1) {
+			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", stat_name, errno, strerror(errno));
+			rv = -1;
+		} else {
+			stat_size = 16384;
+			stat_buf = xmalloc(stat_size);
+		}
+	}
+
+	if (!snap_in_use)
+		return rv;
+
+	if (sysinfo(&si) == 0) {
+		use_sysinfo = TRUE;
+		return rv;
+	}
+
+	log_message(LOG_WARNING, "sysinfo() failed (errno = %d = '%s'), using %s and %s",
+		errno, strerror(errno), load_name, mem_name);
+
+	load_fd = open(load_name, O_RDONLY);
+	if (load_fd == -1) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", load_name, errno, strerror(errno));
+		rv = -1;
+	}
+
+	mem_fd = open(mem_name, O_RDONLY);
+	if (mem_fd == -1) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", mem_name, errno, strerror(errno));
+		rv = -1;
+	}
+
+	return rv;
+}
+
+/* ============================================================================ */
+
+/*
+ * Refresh the snapshot, this should be called once per interval before any of
+ * the checks that use 'sys_snap' are made.
+ */
+
+int update_snapshot(void)
+{
+	struct sysinfo si;
+	int err, ii;
+
+	sys_snap.valid = FALSE;
+	sys_snap.stat_text = NULL;
+
+	if (!snap_in_use)
+		return (ENOERR);
+
+	if (use_sysinfo) {
+		if (sysinfo(&si) != 0) {
+			err = errno;
+			log_message(LOG_ERR, "sysinfo() gave errno = %d = '%s'", err, strerror(err));
+			return (err);
+		}
+
+		/* sysinfo() loads are fixed-point with SI_LOAD_SHIFT bits of fraction, round as the kernel does. */
+		for (ii = 0; ii < 3; ii++) {
+			sys_snap.load[ii] = (unsigned long)
+				(((unsigned long long)si.loads[ii] * LOAD_SCALE + (1UL << (SI_LOAD_SHIFT - 1))) >> SI_LOAD_SHIFT);
+		}
+
+		if (si.mem_unit == 0)
+			si.mem_unit = 1;	/* Kernels before 2.3.23 return bytes with mem_unit unset. */
+
+		sys_snap.freemem  = (unsigned long)((unsigned long long)si.freeram  * si.mem_unit / 1024);
+		sys_snap.freeswap = (unsigned long)((unsigned long long)si.freeswap * si.mem_unit / 1024);
+		sys_snap.procs    = si.procs;
+	} else {
+		if ((err = parse_loadavg()) != ENOERR)
+			return (err);
+		if ((err = parse_meminfo()) != ENOERR)
+			return (err);
+	}
+
+	if ((err = read_online_cpus()) != ENOERR)
+		return (err);
+
+	if ((err = read_proc_stat()) != ENOERR)
+		return (err);
+
+	sys_snap.valid = TRUE;
+	return (ENOERR);
+}
+
+/* ============================================================================ */
+
+int close_snapshot(void)
+{
+	int rv = 0;
+
+	if (load_fd != -1 && close(load_fd) == -1) {
+		log_message(LOG_ALERT, "cannot close %s (errno = %d)", load_name, errno);
+		rv = -1;
+	}
+
+	if (mem_fd != -1 && close(mem_fd) == -1) {
+		log_message(LOG_ALERT, "cannot close %s (errno = %d)", mem_name, errno);
+		rv = -1;
+	}
+
+	if (cpu_fd != -1 && close(cpu_fd) == -1) {
+		log_message(LOG_ALERT, "cannot close %s (errno = %d)", cpu_name, errno);
+		rv = -1;
+	}
+
+	if (stat_fd != -1 && close(stat_fd) == -1) {
+		log_message(LOG_ALERT, "cannot close %s (errno = %d)", stat_name, errno);
+		rv = -1;
+	}
+
+	if (stat_buf != NULL) {
+		free(stat_buf);
+	}
+
+	load_fd = -1;
+	mem_fd = -1;
+	cpu_fd = -1;
+	stat_fd = -1;
+	stat_buf = NULL;
+	stat_size = 0;
+	snap_in_use = FALSE;
+	use_sysinfo = FALSE;
+	sys_snap.valid = FALSE;
+	sys_snap.stat_text = NULL;
+	return rv;
+}
+
+/* ============================================================================ */
+
+/*
+ * Read the whole of an already-open /proc file in to 'buf' as a nul-terminated string.
+ */
+
+static int read_text(int fd, const char *name, char *buf, size_t len)
+{
+	int n;
+
+	if (fd == -1)
+		return (EBADF);
+
+	if ((n = pread(fd, buf, len - 1, 0)) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", name, err, strerror(err));
+		return (err);
+	}
+
+	/* Force string to be nul-terminated. */
+	buf[n] = 0;
+	return (ENOERR);
+}
+
+/*
+ * Parse a load average value such as "12.34" in to a LOAD_SCALE fixed-point number.
+ * Returns a pointer to the first character after the number.
+ */
+
+static char *parse_load(char *p, unsigned long *val)
+{
+	unsigned long v = 0, frac = 0, scale = 1;
+
+	while (*p == ' ')
+		p++;
+
+	while (*p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9') {
+			if (scale < LOAD_SCALE) {
+				frac = frac * 10 + (*p - '0');
+				scale *= 10;
+			}
+			p++;
+		}
+	}
+
+	*val = v * LOAD_SCALE + frac * (LOAD_SCALE / scale);
+	return p;
+}
+
+static int parse_loadavg(void)
+{
+	char buf[80], *ptr;
+	int err, ii;
+
+	if ((err = read_text(load_fd, load_name, buf, sizeof(buf))) != ENOERR)
+		return (err);
+
+	/* Format is "0.01 0.05 0.10 1/234 5678" */
+	ptr = buf;
+	for (ii = 0; ii < 3; ii++) {
+		char *next = parse_load(ptr, &sys_snap.load[ii]);
+		if (next == ptr || (*next != ' ' && *next != '\n')) {
+			log_message(LOG_ERR, "%s does not contain any data (read = %s)", load_name, buf);
+			return (ENOLOAD);
+		}
+		ptr = next;
+	}
+
+	/* The running/total field gives us the number of tasks. */
+	ptr = strchr(ptr, '/');
+	sys_snap.procs = (ptr != NULL) ? strtoul(ptr + 1, NULL, 10) : 0;
+
+	return (ENOERR);
+}
+
+static int parse_meminfo(void)
+{
+	char buf[1024], *ptr1, *ptr2;
+	int err;
+
+	if ((err = read_text(mem_fd, mem_name, buf, sizeof(buf))) != ENOERR)
+		return (err);
+
+	ptr1 = strstr(buf, FREEMEM);
+	ptr2 = strstr(buf, FREESWAP);
+
+	if (!ptr1 || !ptr2) {
+		log_message(LOG_ERR, "%s contains invalid data (read = %s)", mem_name, buf);
+		return (EINVMEM);
+	}
+
+	sys_snap.freemem  = strtoul(ptr1 + strlen(FREEMEM), NULL, 10);
+	sys_snap.freeswap = strtoul(ptr2 + strlen(FREESWAP), NULL, 10);
+
+	return (ENOERR);
+}
+
+/*
+ * Count the on-line CPUs from the kernel's list of ranges, for example "0-3,8-11"
+ * or just "0" for a single CPU. If the sysfs file is not there, use sysconf().
+ */
+
+static int read_online_cpus(void)
+{
+	char buf[256], *p;
+	int err, count = 0;
+	long ncpus;
+
+	if (!maxload1_cpu && !maxload5_cpu && !maxload15_cpu)
+		return (ENOERR);
+
+	if (cpu_fd == -1) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		count = (ncpus > 0) ? (int)ncpus : 1;
+	} else {
+		if ((err = read_text(cpu_fd, cpu_name, buf, sizeof(buf))) != ENOERR)
+			return (err);
+
+		for (p = buf; *p >= '0' && *p <= '9'; ) {
+			unsigned long first, last;
+
+			first = last = strtoul(p, &p, 10);
+			if (*p == '-')
+				last = strtoul(p + 1, &p, 10);
+			if (last >= first)
+				count += last - first + 1;
+			if (*p == ',')
+				p++;
+		}
+
+		if (count == 0) {
+			log_message(LOG_ERR, "%s contains invalid data (read = %s)", cpu_name, buf);
+			return (ENOLOAD);
+		}
+	}
+
+	if (sys_snap.ncpus != 0 && sys_snap.ncpus != count)
+		log_message(LOG_INFO, "number of on-line CPUs changed from %d to %d", sys_snap.ncpus, count);
+
+	sys_snap.ncpus = count;
+	return (ENOERR);
+}
+
+/*
+ * Read all of /proc/stat, growing the buffer if it is too small, and pull out the
+ * "procs_running" and "procs_blocked" values. The text is kept for other checks.
+ */
+
+static int read_proc_stat(void)
+{
+	char *ptr1, *ptr2;
+	int n;
+
+	if (stat_fd == -1)
+		return (ENOERR);
+
+	while ((n = pread(stat_fd, stat_buf, stat_size - 1, 0)) >= (int)stat_size - 1) {
+		char *bigger = realloc(stat_buf, 2 * stat_size);
+		if (bigger == NULL) {
+			log_message(LOG_ERR, "cannot grow %s buffer to %lu bytes", stat_name, (unsigned long)(2 * stat_size));
+			return (ENOMEM);
+		}
+		stat_buf = bigger;
+		stat_size *= 2;
+	}
+
+	if (n < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", stat_name, err, strerror(err));
+		return (err);
+	}
+	/* Force string to be nul-terminated. */
+	stat_buf[n] = 0;
+
+	ptr1 = strstr(stat_buf, "\nprocs_running ");
+	ptr2 = strstr(stat_buf, "\nprocs_blocked ");
+
+	if (!ptr1 || !ptr2) {
+		log_message(LOG_ERR, "%s contains invalid data", stat_name);
+		return (ENOLOAD);
+	}
+
+	sys_snap.procs_running = strtoul(ptr1 + strlen("\nprocs_running "), NULL, 10);
+	sys_snap.procs_blocked = strtoul(ptr2 + strlen("\nprocs_blocked "), NULL, 10);
+	sys_snap.stat_text = stat_buf;
+
+	return (ENOERR);
+}
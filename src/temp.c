@@ -7,18 +7,38 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/stat.h>
 
 #include "extern.h"
 #include "watch_err.h"
+#include "read-conf.h"
 
-static int temp_fd = -1;
+/*
+ * Ring buffer of recent samples for the temperature trend prediction. The sums
+ * for the least-squares fit are kept up to date as samples are added & dropped,
+ * and are re-computed from the buffer each time it wraps so rounding errors do not
+ * build up, and so the time base can be moved up to keep the numbers small.
+ */
+struct temptrend {
+	int count;					/* number of samples in buffer */
+	int next;					/* where the next sample goes */
+	long long base;				/* time (ms) that sample times are relative to */
+	long long *when;			/* sample times (ms, CLOCK_MONOTONIC) */
+	int *temp;					/* sample values (milli-Celsius) */
+	double sx, sy, sxx, sxy;	/* sums for least-squares fit */
+};
 
-static int templevel1;
-static int templevel2;
-static int templevel3;
+static int temp_fd = -1;
 
-static int read_temp_sensor(const char *name, int *val);
+static int read_temp_sensor(struct list *act, int *val);
+static int read_sensor_limit(const char *name);
+static int predict_temp(struct list *act, int temperature);
+static int sample_temp(struct list *act);
+static void open_temp_alarms(struct list *act);
 
 /* ================================================================= */
 
@@ -34,38 +54,71 @@ int open_tempcheck(struct list *tlist)
 		temp_fd = 0;
 
 		/*
-		 * Clear flags and set/compute warning and max thresholds. Make
-		 * sure that each level is distinct and properly ordered so that
-		 * we have templevel1 < templevel2 < templevel3 < maxtemp
+		 * Open each sensor, clear flags and set/compute warning and max thresholds.
+		 * All of these are in milli-Celsius. Make sure that each level is distinct
+		 * and properly ordered so that we have level1 < level2 < level3 < max
 		 */
 		for (act = tlist; act != NULL; act = act->next) {
+			struct tempmode *tm = &act->parameter.temp;
 			int itmp = 0;
-			act->parameter.temp.have1 = FALSE;
-			act->parameter.temp.have2 = FALSE;
-			act->parameter.temp.have3 = FALSE;
+
+			tm->have1 = FALSE;
+			tm->have2 = FALSE;
+			tm->have3 = FALSE;
+
+			tm->max = 1000 * maxtemp;
+			if (tm->autodetected) {
+				int crit = read_sensor_limit(act->name);
+				if (crit > 0) {
+					tm->max = crit;
+				}
+			}
+
+			tm->level3 = (tm->max / 100) * 98;
+			if (tm->level3 >= tm->max) {
+				tm->level3 = tm->max - 1000;
+			}
+
+			tm->level2 = (tm->max / 100) * 95;
+			if (tm->level2 >= tm->level3) {
+				tm->level2 = tm->level3 - 1000;
+			}
+
+			tm->level1 = (tm->max / 100) * 90;
+			if (tm->level1 >= tm->level2) {
+				tm->level1 = tm->level2 - 1000;
+			}
+
+			tm->fd = open(act->name, O_RDONLY);
+			if (tm->fd == -1) {
+				int err = errno;
+				log_message(LOG_ERR, "failed to open %s (%s)", act->name, strerror(err));
+			}
+
+			if (temp_horizon > 0 && temp_samples > 1) {
+				tm->trend = xcalloc(1, sizeof(struct temptrend));
+				tm->trend->when = xcalloc(temp_samples, sizeof(long long));
+				tm->trend->temp = xcalloc(temp_samples, sizeof(int));
+			}
+
+			tm->alarm_fd = tm->crit_alarm_fd = -1;
+			tm->skip = 0;
+
 			/* Check the sensors is usable when initialising. */
-			if (read_temp_sensor(act->name, &itmp) == ENOERR) {
-				act->parameter.temp.in_use = TRUE;
+			if (tm->fd != -1 && read_temp_sensor(act, &itmp) == ENOERR) {
+				tm->in_use = TRUE;
+				if (temp_alarm)
+					open_temp_alarms(act);
+				if (tm->autodetected && verbose)
+					log_message(LOG_DEBUG, "temperature limit is %d.%03d for %s",
+						tm->max / 1000, tm->max % 1000, act->name);
 			} else {
-				act->parameter.temp.in_use = FALSE;
+				tm->in_use = FALSE;
 				log_message(LOG_WARNING, "Disabling temperature check for %s", act->name);
 			}
 		}
 
-		templevel3 = (maxtemp * 98) / 100;
-		if (templevel3 >= maxtemp) {
-			templevel3 = maxtemp - 1;
-		}
-
-		templevel2 = (maxtemp * 95) / 100;
-		if (templevel2 >= templevel3) {
-			templevel2 = templevel3 - 1;
-		}
-
-		templevel1 = (maxtemp * 90) / 100;
-		if (templevel1 >= templevel2) {
-			templevel1 = templevel2 - 1;
-		}
+		rv = 0;
 	}
 
 	return rv;
@@ -90,94 +143,417 @@ int open_tempcheck(struct list *tlist)
  * > cat /sys/class/hwmon/hwmon0/device/temp1_input
  * 36000
  *
- * For 36.0C so we read and print as fraction, but truncate so only the whole deg C is used
- * for the watchdog tests below.
+ * For 36.0C. The file is kept open from open_tempcheck() and read with pread() each time,
+ * and the value is kept as an integer in milli-Celsius for the watchdog tests below.
  */
 
-static int read_temp_sensor(const char *name, int *val)
+static int read_temp_sensor(struct list *act, int *val)
 {
-	float temp;
-	char buf[128];
+	char buf[32];
 	char *p;
-	int err;
-	FILE *fp;
+	int n, temp = 0, neg = FALSE;
 
-	fp = fopen(name, "r");
-	if (fp == NULL) {
-		err = errno;
-		log_message(LOG_ERR, "failed to open %s (%s)", name, strerror(err));
+	n = pread(act->parameter.temp.fd, buf, sizeof(buf)-1, 0);
+	if (n <= 0) {
+		int err = (n == 0) ? ENODATA : errno;
+		log_message(LOG_ERR, "failed to read %s (%s)", act->name, strerror(err));
 		return err;
 	}
+	buf[n] = 0;
 
-	buf[0] = 0; /* to be safe... */
-	p = fgets(buf, sizeof(buf)-1, fp);
-	err = errno;
-	fclose(fp);
+	/* New style sensors read in milli-Celsius, keep it as integer. */
+	p = buf;
+	if (*p == '-') {
+		neg = TRUE;
+		p++;
+	}
 
-	if (p == NULL) {
-		log_message(LOG_ERR, "failed to read %s (%s)", name, strerror(err));
-		return err;
+	if (*p < '0' || *p > '9') {
+		log_message(LOG_ERR, "%s contains invalid data (read = %s)", act->name, buf);
+		return EINVAL;
 	}
 
-	/* New style sensors read in milli-Celsius, convert to deg C as float. */
-	temp = 1.0e-3F * atof(buf);
+	while (*p >= '0' && *p <= '9')
+		temp = temp * 10 + (*p++ - '0');
 
-	if (verbose && logtick && ticker == 1)
-		log_message(LOG_DEBUG, "current temperature is %.3f for %s", temp, name);
+	*val = neg ? -temp : temp;
 
-	/* convert to integer of whole deg C, small addition to make sure matches integer version. */
-	*val = (int)(1.0e-5F + temp);
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "current temperature is %s%d.%03d for %s",
+			neg ? "-" : "", temp / 1000, temp % 1000, act->name);
 
 	return ENOERR;
 }
 
+/*
+ * Read a single integer value from a small sysfs file (used at start-up only).
+ */
+
+static int read_sysfs_int(const char *name, int *val)
+{
+	char buf[32];
+	int fd, n;
+
+	fd = open(name, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	n = pread(fd, buf, sizeof(buf)-1, 0);
+	close(fd);
+
+	if (n <= 0)
+		return -1;
+
+	buf[n] = 0;
+	*val = atoi(buf);
+	return 0;
+}
+
+/*
+ * For an auto-detected sensor find its critical temperature in milli-Celsius, or 0
+ * if it has none. For hwmon this is tempN_crit next to tempN_input, and for a thermal
+ * zone it is the trip point whose type is "critical".
+ */
+
+static int read_sensor_limit(const char *name)
+{
+	char path[PATH_MAX];
+	const char *suffix = "_input";
+	size_t len = strlen(name);
+	int crit = 0;
+
+	if (len > strlen(suffix) && len < sizeof(path) && strcmp(name + len - strlen(suffix), suffix) == 0) {
+		snprintf(path, sizeof(path), "%.*s_crit", (int)(len - strlen(suffix)), name);
+		if (read_sysfs_int(path, &crit) != 0)
+			crit = 0;
+	} else if (len > 5 && len < sizeof(path) && strcmp(name + len - 5, "/temp") == 0) {
+		int ii;
+
+		for (ii = 0; ; ii++) {
+			char type[32];
+			int fd, n;
+
+			snprintf(path, sizeof(path), "%.*s/trip_point_%d_type", (int)(len - 5), name, ii);
+			if ((fd = open(path, O_RDONLY)) == -1)
+				break;
+			n = pread(fd, type, sizeof(type)-1, 0);
+			close(fd);
+
+			if (n > 0 && strncmp(type, "critical", 8) == 0) {
+				snprintf(path, sizeof(path), "%.*s/trip_point_%d_temp", (int)(len - 5), name, ii);
+				if (read_sysfs_int(path, &crit) != 0)
+					crit = 0;
+				break;
+			}
+		}
+	}
+
+	return crit;
+}
+
+/*
+ * Is the sensor with the resolved path 'real' already in the list? The thermal
+ * zones also register as hwmon devices, and those appear below the zone in
+ * /sys/devices, so they are counted as the same sensor as the zone's own 'temp'.
+ */
+
+static int have_sensor(struct list *list, const char *real)
+{
+	char other[PATH_MAX];
+	struct list *act;
+
+	if (strstr(real, "/thermal/thermal_zone") != NULL && strstr(real, "/hwmon") != NULL)
+		return TRUE;
+
+	for (act = list; act != NULL; act = act->next) {
+		if (realpath(act->name, other) != NULL && strcmp(other, real) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Find all hwmon and thermal zone temperature sensors, and add them to the list.
+ */
+
+void find_temp_sensors(struct list **list)
+{
+	static const char *patterns[] = {
+		"/sys/class/hwmon/hwmon*/temp*_input",
+		"/sys/class/hwmon/hwmon*/device/temp*_input",
+		"/sys/class/thermal/thermal_zone*/temp",
+		NULL
+	};
+	struct list *act;
+	int ii;
+	size_t jj;
+
+	for (ii = 0; patterns[ii] != NULL; ii++) {
+		glob_t gl;
+
+		if (glob(patterns[ii], 0, NULL, &gl) != 0)
+			continue;
+
+		for (jj = 0; jj < gl.gl_pathc; jj++) {
+			char real[PATH_MAX];
+
+			if (realpath(gl.gl_pathv[jj], real) == NULL)
+				continue;
+
+			if (have_sensor(*list, real)) {
+				if (verbose)
+					log_message(LOG_DEBUG, "skipping %s, already in list of temperature sensors", gl.gl_pathv[jj]);
+				continue;
+			}
+
+			if (verbose)
+				log_message(LOG_DEBUG, "adding %s to list of temperature sensors", gl.gl_pathv[jj]);
+
+			add_list(list, gl.gl_pathv[jj], 0);
+			for (act = *list; act->next != NULL; act = act->next) {
+				/* loop to find end of list. */
+			}
+			act->parameter.temp.autodetected = TRUE;
+			act->parameter.temp.fd = act->parameter.temp.alarm_fd = act->parameter.temp.crit_alarm_fd = -1;
+		}
+
+		globfree(&gl);
+	}
+}
+
 /* ================================================================= */
 
 int check_temp(struct list *act)
 {
-	int temperature = 0;
-	int err;
+	struct tempmode *tm;
 
 	/* is the temperature device open? */
 	if (temp_fd == -1 || act == NULL || act->parameter.temp.in_use == FALSE)
 		return (ENOERR);
 
-	err = read_temp_sensor(act->name, &temperature);
+	tm = &act->parameter.temp;
+
+	/* Sensors with alarm attributes tell us of trouble, so only sample them now and then. */
+	if (tm->alarm_fd != -1 || tm->crit_alarm_fd != -1) {
+		if (++tm->skip < temp_alarm_interval)
+			return (ENOERR);
+		tm->skip = 0;
+	}
+
+	return sample_temp(act);
+}
+
+/*
+ * Read a sensor and check it against the warning levels and limit.
+ */
+
+static int sample_temp(struct list *act)
+{
+	struct tempmode *tm = &act->parameter.temp;
+	int temperature = 0;
+	int err;
+
+	err = read_temp_sensor(act, &temperature);
 	if (err != ENOERR) {
 		return (err);
 	}
 
 	/* Print out warnings as we cross the 90/95/98 percent thresholds. */
-	if (temperature > templevel3) {
-		if (!act->parameter.temp.have3) {
+	if (temperature > tm->level3) {
+		if (!tm->have3) {
 			/* once we reach level3, issue a warning once. */
-			log_message(LOG_WARNING, "temperature increases above %d (%s)", templevel3, act->name);
-			act->parameter.temp.have1 = act->parameter.temp.have2 = act->parameter.temp.have3 = TRUE;
+			log_message(LOG_WARNING, "temperature increases above %d (%s)", tm->level3 / 1000, act->name);
+			tm->have1 = tm->have2 = tm->have3 = TRUE;
 		}
-	} else if (temperature > templevel2) {
-		if (!act->parameter.temp.have2) {
-			log_message(LOG_WARNING, "temperature increases above %d (%s)", templevel2, act->name);
-			act->parameter.temp.have1 = act->parameter.temp.have2 = TRUE;
+	} else if (temperature > tm->level2) {
+		if (!tm->have2) {
+			log_message(LOG_WARNING, "temperature increases above %d (%s)", tm->level2 / 1000, act->name);
+			tm->have1 = tm->have2 = TRUE;
 		}
-		act->parameter.temp.have3 = FALSE;
-	} else if (temperature > templevel1) {
-		if (!act->parameter.temp.have1) {
-			log_message(LOG_WARNING, "temperature increases above %d (%s)", templevel1, act->name);
-			act->parameter.temp.have1 = TRUE;
+		tm->have3 = FALSE;
+	} else if (temperature > tm->level1) {
+		if (!tm->have1) {
+			log_message(LOG_WARNING, "temperature increases above %d (%s)", tm->level1 / 1000, act->name);
+			tm->have1 = TRUE;
 		}
-		act->parameter.temp.have2 = act->parameter.temp.have3 = FALSE;
+		tm->have2 = tm->have3 = FALSE;
 	} else {
 		/* Below all thresholds, report clear only if previously set. */
-		if (act->parameter.temp.have1 || act->parameter.temp.have2 || act->parameter.temp.have3) {
+		if (tm->have1 || tm->have2 || tm->have3) {
 			log_message(LOG_INFO, "temperature now OK again for %s", act->name);
 		}
-		act->parameter.temp.have1 = act->parameter.temp.have2 = act->parameter.temp.have3 = FALSE;
+		tm->have1 = tm->have2 = tm->have3 = FALSE;
 	}
 
-	if (temperature >= maxtemp) {
-		log_message(LOG_ERR, "it is too hot inside (temperature = %d >= %d for %s)", temperature, maxtemp, act->name);
+	if (temperature >= tm->max) {
+		log_message(LOG_ERR, "it is too hot inside (temperature = %d >= %d for %s)",
+			temperature / 1000, tm->max / 1000, act->name);
 		return (ETOOHOT);
 	}
+
+	return predict_temp(act, temperature);
+}
+
+/* ================================================================= */
+
+/*
+ * Called from the main loop's ppoll() when the driver has notified a change to
+ * one of the sensor's alarm attributes. Reading the attribute re-arms it.
+ */
+
+static int temp_alarm_event(int fd, short revents GCC_UNUSED, void *arg)
+{
+	struct list *act = arg;
+	struct tempmode *tm = &act->parameter.temp;
+	char buf[16];
+	int n;
+
+	n = pread(fd, buf, sizeof(buf)-1, 0);
+	if (n <= 0) {
+		int err = (n == 0) ? ENODATA : errno;
+		log_message(LOG_ERR, "failed to read alarm for %s (%s)", act->name, strerror(err));
+		return err;
+	}
+	buf[n] = 0;
+
+	if (atoi(buf) != 0) {
+		/* Even a critical alarm is only acted on if the reading is over our own limit. */
+		if (fd == tm->crit_alarm_fd)
+			log_message(LOG_ERR, "critical temperature alarm for %s", act->name);
+		else
+			log_message(LOG_WARNING, "temperature alarm for %s", act->name);
+	} else if (verbose) {
+		log_message(LOG_DEBUG, "temperature alarm cleared for %s", act->name);
+	}
+
+	/* Take a reading now rather than waiting for the next slow sample. */
+	tm->skip = 0;
+	return sample_temp(act);
+}
+
+/*
+ * For a hwmon sensor tempN_input, open tempN_alarm & tempN_crit_alarm (if the
+ * driver provides them) and add them to the main loop's ppoll() set.
+ */
+
+static void open_temp_alarms(struct list *act)
+{
+	struct tempmode *tm = &act->parameter.temp;
+	const char *suffix = "_input";
+	size_t len = strlen(act->name);
+	char path[PATH_MAX];
+	char buf[16];
+
+	if (len <= strlen(suffix) || len >= sizeof(path) || strcmp(act->name + len - strlen(suffix), suffix) != 0)
+		return;
+
+	snprintf(path, sizeof(path), "%.*s_alarm", (int)(len - strlen(suffix)), act->name);
+	tm->alarm_fd = open(path, O_RDONLY);
+	if (tm->alarm_fd != -1) {
+		/* read once so only changes from now on are reported */
+		if (pread(tm->alarm_fd, buf, sizeof(buf), 0) < 0 ||
+			add_event_fd(tm->alarm_fd, POLLPRI, temp_alarm_event, act, act) != 0) {
+			close(tm->alarm_fd);
+			tm->alarm_fd = -1;
+		}
+	}
+
+	snprintf(path, sizeof(path), "%.*s_crit_alarm", (int)(len - strlen(suffix)), act->name);
+	tm->crit_alarm_fd = open(path, O_RDONLY);
+	if (tm->crit_alarm_fd != -1) {
+		if (pread(tm->crit_alarm_fd, buf, sizeof(buf), 0) < 0 ||
+			add_event_fd(tm->crit_alarm_fd, POLLPRI, temp_alarm_event, act, act) != 0) {
+			close(tm->crit_alarm_fd);
+			tm->crit_alarm_fd = -1;
+		}
+	}
+
+	if (verbose && (tm->alarm_fd != -1 || tm->crit_alarm_fd != -1))
+		log_message(LOG_DEBUG, "using alarm attributes for %s", act->name);
+}
+
+/* ================================================================= */
+
+static void trend_sums(struct temptrend *tr, int idx, double sign)
+{
+	double x = (double)(tr->when[idx] - tr->base);
+	double y = (double)tr->temp[idx];
+
+	tr->sx  += sign * x;
+	tr->sy  += sign * y;
+	tr->sxx += sign * x * x;
+	tr->sxy += sign * x * y;
+}
+
+/*
+ * Add the latest sample to the sensor's trend buffer, fit a straight line to the
+ * recent samples, and if the temperature is rising fast enough to reach the limit
+ * within 'temp_horizon' seconds then report it so the repair binary can act first.
+ */
+
+static int predict_temp(struct list *act, int temperature)
+{
+	struct tempmode *tm = &act->parameter.temp;
+	struct temptrend *tr = tm->trend;
+	double n, den, slope;
+	long long now;
+
+	if (tr == NULL)
+		return (ENOERR);
+
+	now = mono_ms();
+
+	if (tr->count == temp_samples) {
+		/* Drop the oldest sample, which is the one about to be over-written. */
+		trend_sums(tr, tr->next, -1.0);
+	} else {
+		tr->count++;
+	}
+
+	if (tr->count == 1)
+		tr->base = now;
+
+	tr->when[tr->next] = now;
+	tr->temp[tr->next] = temperature;
+	trend_sums(tr, tr->next, 1.0);
+
+	if (++tr->next == temp_samples) {
+		int ii;
+
+		/* Wrapped, so start again with the oldest sample time as the base. */
+		tr->next = 0;
+		tr->base = tr->when[0];
+		tr->sx = tr->sy = tr->sxx = tr->sxy = 0.0;
+		for (ii = 0; ii < tr->count; ii++)
+			trend_sums(tr, ii, 1.0);
+	}
+
+	/* Wait for the buffer to fill before trusting the fit. */
+	if (tr->count < temp_samples)
+		return (ENOERR);
+
+	n = tr->count;
+	den = n * tr->sxx - tr->sx * tr->sx;
+	if (den <= 0.0)
+		return (ENOERR);
+
+	/* Slope is in milli-Celsius per ms, so Celsius per second. */
+	slope = (n * tr->sxy - tr->sx * tr->sy) / den;
+
+	if (verbose && logtick && ticker == 1)
+		log_message(LOG_DEBUG, "temperature trend is %+.3f C/s for %s", slope, act->name);
+
+	if (slope > 0.0) {
+		double secs = (tm->max - temperature) / (1000.0 * slope);
+
+		if (secs < temp_horizon) {
+			log_message(LOG_ERR, "temperature rising at %.3f C/s will reach %d in %.0f seconds (%s)",
+				slope, tm->max / 1000, secs, act->name);
+			return (ETEMPRISE);
+		}
+	}
+
 	return (ENOERR);
 }
 
@@ -186,8 +562,31 @@ int check_temp(struct list *act)
 int close_tempcheck(void)
 {
 	int rv = -1;
+	struct list *act;
 
 	if (temp_fd != -1) {
+		for (act = temp_list; act != NULL; act = act->next) {
+			if (act->parameter.temp.fd != -1) {
+				close(act->parameter.temp.fd);
+				act->parameter.temp.fd = -1;
+			}
+			if (act->parameter.temp.alarm_fd != -1) {
+				remove_event_fd(act->parameter.temp.alarm_fd);
+				close(act->parameter.temp.alarm_fd);
+				act->parameter.temp.alarm_fd = -1;
+			}
+			if (act->parameter.temp.crit_alarm_fd != -1) {
+				remove_event_fd(act->parameter.temp.crit_alarm_fd);
+				close(act->parameter.temp.crit_alarm_fd);
+				act->parameter.temp.crit_alarm_fd = -1;
+			}
+			if (act->parameter.temp.trend != NULL) {
+				free(act->parameter.temp.trend->when);
+				free(act->parameter.temp.trend->temp);
+				free(act->parameter.temp.trend);
+				act->parameter.temp.trend = NULL;
+			}
+		}
 		rv = 0;
 	}
 
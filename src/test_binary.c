@@ -46,7 +46,7 @@ static int add_process(const char *name, pid_t pid)
 
 	snprintf(node->proc_name, sizeof(node->proc_name), "%s", name);
 	node->pid = pid;
-	node->time = time(NULL);
+	node->time = mono_seconds();
 	node->ecode = 0;
 	node->is_done = FALSE;
 	node->next = process_head;
@@ -168,7 +168,7 @@ static void gather_children(void)
 static int check_timeouts(int timeout)
 {
 	struct process *current;
-	time_t now = time(NULL);
+	time_t now = mono_seconds();
 
 	current = process_head;
 	while (current != NULL) {
@@ -0,0 +1,166 @@
+/* > timejump.c
+ *
+ * Code for noticing when the system clock is stepped, for example by ntpdate
+ * at boot or someone running 'date -s'. Most checks use the monotonic clock and
+ * don't care, but file modification times are in real time, and applications
+ * that see the clock jump may misbehave.
+ *
+ * A timerfd on CLOCK_REALTIME with TFD_TIMER_CANCEL_ON_SET is kept in the main
+ * loop's ppoll() set, so the kernel tells us as soon as the clock is set. The
+ * size of the step comes from comparing how far CLOCK_REALTIME has moved with
+ * CLOCK_BOOTTIME, which is also done every interval in case the event is not
+ * available. Any difference between CLOCK_BOOTTIME and CLOCK_MONOTONIC is time
+ * spent suspended and is only logged.
+ *
+ * After a step the checks that depend on real time are re-baselined, and a step
+ * of 'time-jump-threshold' seconds or more is logged, and reported as ETIMEJUMP
+ * if 'time-jump-error' is set.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+#endif
+
+static int tfd = -1;
+static long long last_real, last_mono, last_boot;
+
+static int timerfd_event(int fd, short revents, void *arg);
+
+/* ============================================================================ */
+
+static void take_baseline(void)
+{
+	last_real = clock_ns(CLOCK_REALTIME) / 1000000;
+	last_mono = mono_ms();
+	last_boot = clock_ns(CLOCK_BOOTTIME) / 1000000;
+}
+
+/* Set a timer far in the future that the kernel cancels if the clock is set. */
+static int arm_timer(void)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	clock_gettime(CLOCK_REALTIME, &its.it_value);
+	its.it_value.tv_sec += 10 * 365 * 86400;
+
+	return timerfd_settime(tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+}
+
+int open_timecheck(void)
+{
+	close_timecheck();
+
+	if (time_jump_threshold <= 0)
+		time_jump_threshold = 1;
+
+	take_baseline();
+
+	tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tfd == -1 || arm_timer() != 0 || add_event_fd(tfd, POLLIN, timerfd_event, NULL, NULL) != 0) {
+		/* Not fatal, the step is still seen by check_timejump() at the next interval. */
+		log_message(LOG_WARNING, "cannot watch for clock changes (errno = %d = '%s')", errno, strerror(errno));
+		if (tfd != -1)
+			close(tfd);
+		tfd = -1;
+	}
+
+	return 0;
+}
+
+/* ============================================================================ */
+
+/*
+ * Compare how far the clocks have moved since last time. Normally real time and
+ * boot time move together, so any difference is a step of the clock.
+ */
+
+int check_timejump(void)
+{
+	long long real = clock_ns(CLOCK_REALTIME) / 1000000;
+	long long mono = mono_ms();
+	long long boot = clock_ns(CLOCK_BOOTTIME) / 1000000;
+	long long step = (real - last_real) - (boot - last_boot);
+	long long asleep = (boot - last_boot) - (mono - last_mono);
+
+	last_real = real;
+	last_mono = mono;
+	last_boot = boot;
+
+	if (asleep >= 1000)
+		log_message(LOG_INFO, "system was suspended for %lld seconds", asleep / 1000);
+
+	if (step > -1000 && step < 1000)
+		return (ENOERR);
+
+	/*
+	 * Let the checks using real time start again from now. The file checks are
+	 * the only ones left that compare times from the file system with the clock,
+	 * the rest use the monotonic or boot time clocks.
+	 */
+	rebase_filecheck();
+
+	if (step > -1000LL * time_jump_threshold && step < 1000LL * time_jump_threshold) {
+		if (verbose)
+			log_message(LOG_DEBUG, "clock stepped by %+lld ms", step);
+		return (ENOERR);
+	}
+
+	log_message(LOG_WARNING, "clock stepped by %+lld seconds", step / 1000);
+	return (time_jump_error ? ETIMEJUMP : ENOERR);
+}
+
+/*
+ * Called from the main loop's ppoll() when the clock has been set. The read
+ * fails with ECANCELED, after which the timer must be set again.
+ */
+
+static int timerfd_event(int fd, short revents GCC_UNUSED, void *arg GCC_UNUSED)
+{
+	uint64_t ticks;
+
+	if (read(fd, &ticks, sizeof(ticks)) < 0 && errno != ECANCELED && errno != EAGAIN) {
+		int err = errno;
+		log_message(LOG_ERR, "read of clock timer gave errno = %d = '%s'", err, strerror(err));
+		return (err);
+	}
+
+	if (arm_timer() != 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot reset clock timer (errno = %d = '%s')", err, strerror(err));
+		return (err);
+	}
+
+	return check_timejump();
+}
+
+/* ============================================================================ */
+
+int close_timecheck(void)
+{
+	if (tfd != -1) {
+		remove_event_fd(tfd);
+		close(tfd);
+	}
+
+	tfd = -1;
+	return 0;
+}
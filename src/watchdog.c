@@ -201,7 +201,7 @@ static void wd_action(int result, char *rbinary, struct list *act)
 		/* error that might be repairable */
 		if (act != NULL && retry_timeout > 0) {
 			/* timer possible and used to allow re-try */
-			time_t now = time(NULL);
+			time_t now = mono_seconds();
 			timeout = FALSE;
 
 			if (act->last_time == 0) {
@@ -269,6 +269,12 @@ static void do_check(int res, char *rbinary, struct list *act)
 	wd_action(keep_alive(), rbinary, NULL);
 }
 
+/* Errors reported by descriptors becoming ready while we wait in the main loop. */
+static void event_check(int res, struct list *act)
+{
+	do_check(res, repair_bin, act);
+}
+
 static void old_option(int c, char *configfile)
 {
 	fprintf(stderr, "Option -%c is no longer valid, please specify it in %s.\n", c, configfile);
@@ -278,13 +284,51 @@ static void print_info(int sync_it, int force)
 {
 	struct list *act;
 
-	log_message(LOG_INFO, "int=%ds realtime=%s sync=%s load=%d,%d,%d soft=%s",
+	log_message(LOG_INFO, "int=%ds realtime=%s sync=%s load=%d.%02d,%d.%02d,%d.%02d soft=%s",
 		    tint,
 		    realtime ? "yes" : "no",
 		    sync_it ? "yes" : "no",
-		    maxload1, maxload5, maxload15,
+		    LOAD_INT(maxload1), LOAD_FRAC(maxload1),
+		    LOAD_INT(maxload5), LOAD_FRAC(maxload5),
+		    LOAD_INT(maxload15), LOAD_FRAC(maxload15),
 		    softboot ? "yes" : "no");
 
+	if (maxload1_cpu || maxload5_cpu || maxload15_cpu)
+		log_message(LOG_INFO, "load per CPU=%d.%02d,%d.%02d,%d.%02d",
+		    LOAD_INT(maxload1_cpu), LOAD_FRAC(maxload1_cpu),
+		    LOAD_INT(maxload5_cpu), LOAD_FRAC(maxload5_cpu),
+		    LOAD_INT(maxload15_cpu), LOAD_FRAC(maxload15_cpu));
+
+	if (maxrunning > 0 || maxblocked > 0)
+		log_message(LOG_INFO, "processes: maximum running = %d, blocked = %d", maxrunning, maxblocked);
+
+	if (maxsteal > 0 || maxiowait > 0 || maxirq > 0 || maxsoftirq > 0)
+		log_message(LOG_INFO, "CPU time: maximum steal=%d%% iowait=%d%% irq=%d%% softirq=%d%% for %d intervals",
+			maxsteal, maxiowait, maxirq, maxsoftirq, cpustat_count);
+
+	if (maxlatency > 0 || maxlatency_p99 > 0)
+		log_message(LOG_INFO, "latency: maximum = %d us, 99th percentile = %d us, period = %d us, CPUs = %s",
+			maxlatency, maxlatency_p99, latency_period, (latency_cpus == NULL) ? "all" : latency_cpus);
+
+	if (hung_timeout > 0 || maxdstate > 0)
+		log_message(LOG_INFO, "hung tasks: time-out = %d s, maximum = %d, D state maximum = %d, scan %d per interval",
+			hung_timeout, maxhung, maxdstate, proc_scan_max);
+
+	if (disk_stall_time > 0 || max_disk_await > 0)
+		log_message(LOG_INFO, "disk stats: stall time = %d s, maximum await = %d ms, devices = %s",
+			disk_stall_time, max_disk_await, (diskstats_list == NULL) ? "all" : "as listed");
+
+	if (hw_errors)
+		log_message(LOG_INFO, "hardware errors: maximum corrected = %d in %d s, uncorrected = %d",
+			max_corrected, hw_error_period, max_uncorrected);
+
+	log_message(LOG_INFO, "clock steps: threshold = %d s, error = %s",
+		time_jump_threshold, time_jump_error ? "yes" : "no");
+
+	if (maxfileuse > 0 || maxtaskuse > 0 || maxzombieuse > 0 || maxconntrackuse > 0 || maxsocketuse > 0)
+		log_message(LOG_INFO, "headroom: files = %d%%, tasks = %d%%, zombies = %d%%, conntrack = %d%%, sockets = %d%%",
+			maxfileuse, maxtaskuse, maxzombieuse, maxconntrackuse, maxsocketuse);
+
 	if (minpages == 0 && minalloc == 0)
 		log_message(LOG_INFO, "memory not checked");
 	else
@@ -303,11 +347,41 @@ static void print_info(int sync_it, int force)
 		for (act = file_list; act != NULL; act = act->next)
 			log_message(LOG_INFO, "file: %s:%d", act->name, act->parameter.file.mtime);
 
+	for (act = mount_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "mount: %s (time-out %d seconds, %d times)", act->name, mount_timeout, mount_timeout_count);
+
+	for (act = fs_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "fs space: %s", act->name);
+
+	for (act = mountwatch_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "mount writable: %s", act->name);
+
+	for (act = md_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "md array: %s", act->name);
+
+	for (act = cgroup_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "cgroup: %s (pressure %d ms in %d ms, %d times)", act->name,
+			cgroup_pressure, cgroup_pressure_window, cgroup_pressure_count);
+
+	for (act = kmsg_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "kernel message: \"%s\" (error %d, %d time(s) in %d seconds)", act->name,
+			act->parameter.kmsg.code ? act->parameter.kmsg.code : EKMSG,
+			act->parameter.kmsg.count ? act->parameter.kmsg.count : 1,
+			act->parameter.kmsg.period ? act->parameter.kmsg.period : 60);
+
+	for (act = disk_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "disk probe: %s (every %d seconds, limit %d ms, 99th percentile %d ms%s)", act->name,
+			disk_probe_interval, max_disk_latency, max_disk_latency_p99, disk_probe_direct ? ", O_DIRECT" : "");
+
 	if (pidfile_list == NULL)
 		log_message(LOG_INFO, "pidfile: no server process to check");
 	else
 		for (act = pidfile_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "pidfile: %s", act->name);
+			log_message(LOG_INFO, "pidfile: %s stuck=%d progress=%d", act->name,
+				act->parameter.pid.stuck, act->parameter.pid.progress);
+
+	for (act = process_list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "process: %s", act->name);
 
 	if (iface_list == NULL)
 		log_message(LOG_INFO, "interface: no interface to check");
@@ -319,8 +393,11 @@ static void print_info(int sync_it, int force)
 		log_message(LOG_INFO, "temperature: no sensors to check");
 	else {
 		log_message(LOG_INFO, "temperature: maximum = %d", maxtemp);
+		if (temp_horizon > 0)
+			log_message(LOG_INFO, "temperature: predict %d seconds ahead from %d samples", temp_horizon, temp_samples);
 		for (act = temp_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "temperature: %s", act->name);
+			log_message(LOG_INFO, "temperature: %s%s", act->name,
+				act->parameter.temp.autodetected ? " (auto)" : "");
 	}
 
 	if (tr_bin_list == NULL)
@@ -367,9 +444,9 @@ static void check_parameters(void)
 		err = 1;
 	}
 
-	if (maxload1 > 0 && maxload1 < MINLOAD) {
-		log_message(LOG_ERR, "Using this maximal load average (%d) might reboot the system too often!",
-			    maxload1);
+	if (maxload1 > 0 && maxload1 < MINLOAD * LOAD_SCALE) {
+		log_message(LOG_ERR, "Using this maximal load average (%d.%02d) might reboot the system too often!",
+			    LOAD_INT(maxload1), LOAD_FRAC(maxload1));
 		err = 1;
 	}
 
@@ -452,6 +529,10 @@ int main(int argc, char *const argv[])
 
 	read_config(configfile);
 
+	if (temp_autodetect) {
+		find_temp_sensors(&temp_list);
+	}
+
 	if (softboot) {
 		/* Result of zeroing time-out is immediate action to shut down on errors, rather like old softboot behaviour. */
 		retry_timeout = 0;
@@ -491,12 +572,24 @@ int main(int argc, char *const argv[])
 	log_message(LOG_NOTICE, "starting daemon (%d.%d):", MAJOR_VERSION, MINOR_VERSION);
 	print_info(sync_it, force);
 
+	/* Before the device, as finding which files are on network file systems can take stat-timeout each. */
+	open_filecheck(file_list);
+
 	/* open the device */
 	if (no_act == FALSE) {
 		open_watchdog(devname, dev_timeout);
 	}
 
 	open_tempcheck(temp_list);
+	open_mountcheck(mount_list);
+	open_fscheck(fs_list);
+	open_mountwatch(mountwatch_list);
+	open_kmsg(kmsg_list);
+	open_mdcheck(md_list);
+	open_diskprobe(disk_list);
+	open_pidcheck(pidfile_list);
+	open_proccheck(process_list);
+	open_cgroupcheck(cgroup_list);
 
 	open_heartbeat();
 
@@ -504,12 +597,29 @@ int main(int argc, char *const argv[])
 
 	open_memcheck();
 
+	open_snapshot();
+
+	open_cpustat();
+
+	open_procscan();
+
+	open_headroom();
+
+	open_diskstats();
+
+	open_hwerror();
+
+	open_timecheck();
+
 	/* set signal term to set our run flag to 0 so that */
 	/* we make sure watchdog device is closed when receiving SIGTERM */
 	signal(SIGTERM, sigterm_handler);
 
 	lock_our_memory(realtime, schedprio, daemon_pid);
 
+	/* start the canary threads after setting our priority so they inherit it */
+	open_latency();
+
 	/* Short wait (50ms OK?) in case test binaries return quickly, then
 	 * remaining 'twait' should make watchdog sleep 'tint' seconds total.
 	 */
@@ -526,9 +636,34 @@ int main(int argc, char *const argv[])
 		/* check file table */
 		do_check(check_file_table(), repair_bin, NULL);
 
+		/* check the clock has not been stepped */
+		do_check(check_timejump(), repair_bin, NULL);
+
+		/* take the snapshot of system statistics used by the load & memory checks */
+		do_check(update_snapshot(), repair_bin, NULL);
+
 		/* check load average */
 		do_check(check_load(), repair_bin, NULL);
 
+		/* check CPU steal, iowait & interrupt time */
+		do_check(check_cpustat(), repair_bin, NULL);
+
+		/* check scheduling latency on each CPU */
+		do_check(check_latency(), repair_bin, NULL);
+
+		/* look for tasks hung in D state, a part of /proc at a time */
+		do_check(update_procscan(), repair_bin, NULL);
+		do_check(check_hungtask(), repair_bin, NULL);
+
+		/* check we are not close to running out of files or PIDs */
+		do_check(check_headroom(), repair_bin, NULL);
+
+		/* check block devices are completing I/O */
+		do_check(check_diskstats(), repair_bin, NULL);
+
+		/* check memory and PCIe error counters */
+		do_check(check_hwerror(), repair_bin, NULL);
+
 		/* check free memory */
 		do_check(check_memory(), repair_bin, NULL);
 
@@ -543,10 +678,38 @@ int main(int argc, char *const argv[])
 		for (act = file_list; act != NULL; act = act->next)
 			do_check(check_file_stat(act), repair_bin, act);
 
+		/* check mounts are answering */
+		for (act = mount_list; act != NULL; act = act->next)
+			do_check(check_mount(act), repair_bin, act);
+
+		/* check file systems have space left */
+		for (act = fs_list; act != NULL; act = act->next)
+			do_check(check_fsspace(act), repair_bin, act);
+
+		/* check mounts are still there and writable */
+		for (act = mountwatch_list; act != NULL; act = act->next)
+			do_check(check_mountwatch(act), repair_bin, act);
+
+		/* check RAID arrays are complete */
+		for (act = md_list; act != NULL; act = act->next)
+			do_check(check_mdraid(act), repair_bin, act);
+
+		/* time a write to each disk */
+		for (act = disk_list; act != NULL; act = act->next)
+			do_check(check_diskprobe(act), repair_bin, act);
+
 		/* in pidmode kill -0 processes */
 		for (act = pidfile_list; act != NULL; act = act->next)
 			do_check(check_pidfile(act), repair_bin, act);
 
+		/* check processes given by name are running */
+		for (act = process_list; act != NULL; act = act->next)
+			do_check(check_process(act), repair_bin, act);
+
+		/* check services in their own cgroup */
+		for (act = cgroup_list; act != NULL; act = act->next)
+			do_check(check_cgroup(act), repair_bin, act);
+
 		/* in network mode check the given devices for input */
 		for (act = iface_list; act != NULL; act = act->next)
 			do_check(check_iface(act), repair_bin, act);
@@ -565,9 +728,9 @@ int main(int argc, char *const argv[])
 		usleep(swait);
 		check_bin(NULL, test_timeout, 0);
 
-		/* finally sleep for a full cycle */
+		/* finally sleep for a full cycle, handling any events as they arrive */
 		/* we have just triggered the device with the last check */
-		usleep(twait);
+		wait_for_events(twait, event_check);
 
 		count++;
 